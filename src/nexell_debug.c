@@ -31,6 +31,18 @@
 
 #include "nexell_debug.h"
 
+int nx_debug_level;
+
+/* resolved when the library is loaded, not per message */
+__attribute__((constructor))
+static void nx_debug_init(void)
+{
+	const char *verbose = getenv("NEXELL_G2D_DEBUG");
+
+	if (verbose && *verbose)
+		nx_debug_level = atoi(verbose) > 0 ? atoi(verbose) : 1;
+}
+
 #ifndef NDEBUG
 static void nx_debug_msg_default(const char *file, int line,
 				const char *function,
@@ -38,12 +50,6 @@ static void nx_debug_msg_default(const char *file, int line,
 {
 	va_list arg;
 
-	const char *verbose;
-
-	verbose = getenv("NEXELL_G2D_DEBUG");
-	if (!verbose || !*verbose)
-		return;
-
 	va_start(arg, fmt);
 	fprintf(stderr, "%s:%i:%s: ", file, line, function);
 	vfprintf(stderr, fmt, arg);
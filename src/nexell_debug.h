@@ -29,6 +29,9 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+/* NEXELL_G2D_DEBUG, read once at load: messages are off when 0 */
+extern int nx_debug_level;
+
 #ifndef NDEBUG
 	#ifndef D_DEBUG
 	typedef void (*nx_debug_msg_handler_t)(const char *file, int line,
@@ -36,8 +39,12 @@
 						int err, const char *fmt, ...);
 	extern nx_debug_msg_handler_t nx_debug_msg;
 
-	#define D_DEBUG(args...) \
-		nx_debug_msg(__FILE__, __LINE__, __func__, errno, ##args)
+	/* arguments are not evaluated with the messages off */
+	#define D_DEBUG(args...) do { \
+		if (nx_debug_level) \
+			nx_debug_msg(__FILE__, __LINE__, __func__, \
+				     errno, ##args); \
+		} while (0)
 #endif
 #else
 	#ifndef D_DEBUG
@@ -28,71 +28,32 @@
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <pthread.h>
 #include <xf86drm.h>
 
 #include "nexell_g2d.h"
-
-enum nx_g2d_b_rop_mode {
-	GL_BLEND_ROP_CLEAR = 0,
-	GL_BLEND_ROP_NOR = 1,
-	GL_BLEND_ROP_AND_INVERTED = 2,
-	GL_BLEND_ROP_COPY_INVERTED = 3,
-	GL_BLEND_ROP_AND_REVERSE = 4,
-	GL_BLEND_ROP_NOOP = 5,
-	GL_BLEND_ROP_XOR = 6,
-	GL_BLEND_ROP_NAND = 7,
-	GL_BLEND_ROP_AND = 8,
-	GL_BLEND_ROP_EQUIV = 9,
-	GL_BLEND_ROP_INVERT = 10,
-	GL_BLEND_ROP_OR_INVERTED = 11,
-	GL_BLEND_ROP_COPY = 12,
-	GL_BLEND_ROP_OR_REVERSE = 13,
-	GL_BLEND_ROP_OR = 14,
-	GL_BLEND_ROP_SET = 15,
-};
-
-enum nx_g2d_b_dst_alpha {
-	GL_BLEND_ZERO = 0,
-	GL_BLEND_ONE = 1,
-	GL_BLEND_SRC_COLOR = 2,
-	GL_BLEND_ONE_MINUS_SRC_COLOR = 3,
-	GL_BLEND_DST_COLOR = 4,
-	GL_BLEND_ONE_MINUS_DST_COLOR = 5,
-	GL_BLEND_SRC_ALPHA = 6,
-	GL_BLEND_ONE_MINUS_SRC_ALPHA = 7,
-	GL_BLEND_DST_ALPHA = 8,
-	GL_BLEND_ONE_MINUS_DST_ALPHA = 9,
-	GL_BLEND_CONSTANT_COLOR = 10,
-	GL_BLEND_ONE_MINUS_CONSTANT_COLOR = 11,
-	GL_BLEND_CONSTANT_ALPHA = 12,
-	GL_BLEND_ONE_MINUS_CONSTANT_ALPHA = 13,
-	GL_BLEND_SRC_ALPHA_SATURATE = 14,
-};
-
-enum nx_g2d_b_equat_alpha {
-	GL_EQUATION_FUNC_ADD = 0,
-	GL_EQUATION_FUNC_SUB = 1,
-	GL_EQUATION_FUNC_REVERSE_SUB = 2,
-	GL_EQUATION_FUNC_MIN = 3,
-	GL_EQUATION_FUNC_MAX = 4,
-	GL_EQUATION_FUNC_DARKEN = 5,
-	GL_EQUATION_FUNC_LIGHTEN = 6,
-	GL_EQUATION_FUNC_MULTIPLY = 7,
-};
-
-struct nx_g2d_ctx {
-	int fd;
-	int major;
-	int minor;
-	struct nx_g2d_cmd cmd;
-};
+#include "nexell_g2d_priv.h"
 
 #define	COMMAND(c, v, t) do { \
 		(c)->cmd[t] |= v; \
 		(c)->cmd_mask |= BIT(t); \
 	} while (0)
 
-#define	DITHER(v)	(v < 24 ? 1 : 0)
+/* color (RGB) bits of each G2D color format */
+static const int g2d_color_depth[16] = {
+	[NX_G2D_PIXEL_FMT_RGB565] = 16,
+	[NX_G2D_PIXEL_FMT_XRGB1555] = 15,
+	[NX_G2D_PIXEL_FMT_ARGB1555] = 15,
+	[NX_G2D_PIXEL_FMT_XRGB4444] = 12,
+	[NX_G2D_PIXEL_FMT_ARGB4444] = 12,
+	[NX_G2D_PIXEL_FMT_RGB888] = 24,
+	[NX_G2D_PIXEL_FMT_XRGB8888] = 24,
+	[NX_G2D_PIXEL_FMT_ARGB8888] = 24,
+};
+
+/* dither when the destination has less color depth than the source */
+#define	DITHER(s, d)	\
+	(g2d_color_depth[(d) & 0xf] < g2d_color_depth[(s) & 0xf] ? 1 : 0)
 
 static void
 g2d_op_initialize(struct nx_g2d_cmd *cmd, struct nx_g2d_image *img)
@@ -255,14 +216,21 @@ g2d_op_solid_color(struct nx_g2d_cmd *cmd, unsigned int color, bool enb)
 }
 
 static int
-g2d_submit(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmd)
+g2d_exec_cmd(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmd)
 {
-	struct nx_g2d_cmd arg = *cmd;
+	struct nx_g2d_dev *dev = ctx->dev;
 	int ret;
 
-	COMMAND(&arg, 1, NX_G2D_CMD_RUN);
+	if (dev->sw) {
+		pthread_mutex_lock(&dev->sw_lock);
+		ret = nx_g2d_sw_exec(dev->sw, cmd);
+		pthread_mutex_unlock(&dev->sw_lock);
+		return ret;
+	}
+
+	G2D_STAT_ADD_ATOMIC(ctx, ioctls, 1);
 
-	ret = drmIoctl(ctx->fd, DRM_IOCTL_NX_G2D_DMA_EXEC, &arg);
+	ret = drmIoctl(dev->fd, DRM_IOCTL_NX_G2D_DMA_EXEC, cmd);
 	if (ret < 0) {
 		D_ERROR("%s() Failed DRM_IOCTL_NX_G2D_DMA_EXEC\n", __func__);
 		return ret;
@@ -271,13 +239,289 @@ g2d_submit(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmd)
 	return ret;
 }
 
+/*
+ * Runs the commands with one ioctl when the kernel takes a command
+ * list, otherwise as sequential DRM_IOCTL_NX_G2D_DMA_EXEC.
+ * DRM_IOCTL_NX_G2D_DMA_EXEC_LIST is not part of every nexell_drm.h:
+ * built against a kernel header without it, or on a kernel rejecting
+ * it, a batch takes as many ioctls as unbatched commands.
+ * Called from the submission thread when there is one.
+ */
+int nx_g2d_exec(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmds, int count)
+{
+	int i, ret = 0;
+
+	G2D_STAT_ADD_ATOMIC(ctx, commands, count);
+
+#ifdef DRM_IOCTL_NX_G2D_DMA_EXEC_LIST
+	if (count > 1 && !ctx->dev->sw &&
+	    !(ctx->batch_flags & NX_G2D_BATCH_SEQUENTIAL)) {
+		struct nx_g2d_cmd_list arg = {
+			.cmds = (__u64)(unsigned long)cmds,
+			.count = count,
+		};
+
+		G2D_STAT_ADD_ATOMIC(ctx, ioctls, 1);
+
+		ret = drmIoctl(ctx->dev->fd, DRM_IOCTL_NX_G2D_DMA_EXEC_LIST,
+			       &arg);
+		if (!ret || (errno != ENOTTY && errno != EINVAL)) {
+			if (ret < 0)
+				D_ERROR("%s() Failed DRM_IOCTL_NX_G2D_DMA_EXEC_LIST\n",
+					__func__);
+			return ret;
+		}
+
+		D_DEBUG("command list not supported, replay sequential\n");
+		ctx->batch_flags |= NX_G2D_BATCH_SEQUENTIAL;
+	}
+#endif
+
+	for (i = 0; i < count; i++) {
+		ret = g2d_exec_cmd(ctx, &cmds[i]);
+		if (ret < 0)
+			break;
+	}
+
+	return ret;
+}
+
+/* hands the commands to the submission thread or runs them */
+static int
+g2d_submit_batch(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmds, int count)
+{
+	__u64 start = G2D_TRACE_TIME();
+	int ret;
+
+	nx_g2d_stats_submit(ctx);
+	if (ctx->capture)
+		nx_g2d_capture_submit(ctx, cmds, count);
+	G2D_MARKER_BEGIN("g2d submit ctx %d serial %llu commands %d",
+			 ctx->id, (unsigned long long)ctx->serial, count);
+
+	if (ctx->ring)
+		ret = nx_g2d_ring_push(ctx->ring, cmds, count);
+	else
+		ret = nx_g2d_exec(ctx, cmds, count);
+
+	G2D_MARKER_END();
+	G2D_TRACE(.type = NX_G2D_TRACE_SUBMIT, .ctx = ctx->id, .ts = start,
+		  .serial = ctx->serial, .x = count);
+
+	return ret;
+}
+
+/* the software engine has completed a command once submitted */
+static inline bool
+g2d_done_on_submit(struct nx_g2d_ctx *ctx)
+{
+	return ctx->dev->sw && !ctx->ring;
+}
+
+/* commands up to serial have completed */
+static inline void
+g2d_retire(struct nx_g2d_ctx *ctx, __u64 serial)
+{
+	__atomic_store_n(&ctx->serial_done, serial, __ATOMIC_RELEASE);
+}
+
+static int
+g2d_batch_flush(struct nx_g2d_ctx *ctx)
+{
+	int count = ctx->batch_count;
+	int ret;
+
+	if (!count)
+		return 0;
+
+	ctx->batch_count = 0;
+
+	ret = g2d_submit_batch(ctx, ctx->batch, count);
+
+	/* software engine has completed the batch */
+	if (!ret && g2d_done_on_submit(ctx)) {
+		g2d_retire(ctx, ctx->serial);
+		nx_g2d_stats_retired(ctx);
+	}
+
+	return ret;
+}
+
+/*
+ * The handle table is also read by the dma-buf imports of other threads
+ * before closing a handle. The serial is stored before the handle, so a
+ * reader finding the handle finds at least the serial that used it, and
+ * a replaced serial is in serial_evicted before the slot is reused.
+ */
+static void
+g2d_handle_touch(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	int slot = handle % NX_G2D_HANDLE_SLOTS;
+
+	if (ctx->handles[slot].handle != handle &&
+	    ctx->handles[slot].serial > ctx->serial_evicted)
+		__atomic_store_n(&ctx->serial_evicted,
+				 ctx->handles[slot].serial, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&ctx->handles[slot].serial, ctx->serial,
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(&ctx->handles[slot].handle, handle,
+			 __ATOMIC_RELEASE);
+}
+
+/* serial of the last queued command that may use the handle */
+static __u64
+g2d_handle_serial(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	int slot = handle % NX_G2D_HANDLE_SLOTS;
+	bool hit = __atomic_load_n(&ctx->handles[slot].handle,
+				   __ATOMIC_ACQUIRE) == handle;
+	__u64 serial = __atomic_load_n(&ctx->serial_evicted, __ATOMIC_ACQUIRE);
+	__u64 last = __atomic_load_n(&ctx->handles[slot].serial,
+				     __ATOMIC_RELAXED);
+
+	if (hit && last > serial)
+		serial = last;
+
+	return serial;
+}
+
+/* true if a queued or running command may still use the handle */
+static bool
+g2d_handle_busy(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	return g2d_handle_serial(ctx, handle) >
+		__atomic_load_n(&ctx->serial_done, __ATOMIC_ACQUIRE);
+}
+
+bool nx_g2d_handle_busy(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	return g2d_handle_busy(ctx, handle);
+}
+
+/*
+ * true if a queued command of another context of the device may use the
+ * handle. Those are not synced from this thread, the CPU paths leave
+ * the buffer to the G2D instead.
+ */
+static bool
+g2d_handle_busy_others(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	struct nx_g2d_dev *dev = ctx->dev;
+	struct nx_g2d_ctx *c;
+	bool busy = false;
+
+	pthread_mutex_lock(&dev->ctx_lock);
+	for (c = dev->ctx_list; c && !busy; c = c->next)
+		busy = c != ctx && g2d_handle_busy(c, handle);
+	pthread_mutex_unlock(&dev->ctx_lock);
+
+	return busy;
+}
+
+bool nx_g2d_handle_busy_others(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	return g2d_handle_busy_others(ctx, handle);
+}
+
+/* the CPU may touch the buffer without waiting for any context */
+static bool
+g2d_cpu_idle(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	return !g2d_handle_busy(ctx, handle) &&
+		!g2d_handle_busy_others(ctx, handle);
+}
+
+/*
+ * Returns the command slot to encode the next operation into:
+ * the next free batch entry, or the context command when not batching.
+ */
+static struct nx_g2d_cmd *
+g2d_cmd_get(struct nx_g2d_ctx *ctx)
+{
+	if (ctx->batching && !ctx->list)
+		return &ctx->batch[ctx->batch_count];
+
+	return &ctx->cmd;
+}
+
+/* new serial for a queued command, marks its buffers busy */
+static void
+g2d_cmd_serial(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmd)
+{
+	ctx->serial++;
+
+	if (cmd->cmd[NX_G2D_CMD_SRC_CTRL] & BIT(6))	/* SRC_RD_ENB */
+		g2d_handle_touch(ctx, cmd->src.handle);
+	g2d_handle_touch(ctx, cmd->dst.handle);
+}
+
+static int
+g2d_list_add(struct nx_g2d_list *list, struct nx_g2d_cmd *cmd)
+{
+	if (list->count == list->size) {
+		int size = list->size ? list->size * 2 : NX_G2D_LIST_SIZE;
+		struct nx_g2d_cmd *cmds;
+
+		cmds = realloc(list->cmds, size * sizeof(*cmds));
+		if (!cmds)
+			return -ENOMEM;
+
+		list->cmds = cmds;
+		list->size = size;
+	}
+
+	list->cmds[list->count++] = *cmd;
+
+	return 0;
+}
+
+/* submits commands with their serials, retired if already done */
+static int
+g2d_submit_done(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmds, int count)
+{
+	int ret = g2d_submit_batch(ctx, cmds, count);
+
+	if (!ret && g2d_done_on_submit(ctx)) {
+		g2d_retire(ctx, ctx->serial);
+		nx_g2d_stats_retired(ctx);
+	}
+
+	return ret;
+}
+
+static int
+g2d_cmd_commit(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmd)
+{
+	COMMAND(cmd, 1, NX_G2D_CMD_RUN);
+
+	/* recording, run on replay */
+	if (ctx->list)
+		return g2d_list_add(ctx->list, cmd);
+
+	g2d_cmd_serial(ctx, cmd);
+
+	if (!ctx->batching)
+		return g2d_submit_done(ctx, cmd, 1);
+
+	if (++ctx->batch_count == ctx->batch_size)
+		return g2d_batch_flush(ctx);
+
+	return 0;
+}
+
 static int
 g2d_sync(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmd)
 {
-	struct nx_g2d_cmd arg = *cmd;
 	int ret;
 
-	ret = drmIoctl(ctx->fd, DRM_IOCTL_NX_G2D_DMA_SYNC, &cmd);
+	/* software engine completes every command on submit */
+	if (ctx->dev->sw)
+		return 0;
+
+	G2D_STAT_ADD_ATOMIC(ctx, ioctls, 1);
+
+	ret = drmIoctl(ctx->dev->fd, DRM_IOCTL_NX_G2D_DMA_SYNC, cmd);
 	if (ret < 0) {
 		D_ERROR("%s() Failed DRM_IOCTL_NX_G2D_DMA_SYNC\n", __func__);
 		return ret;
@@ -304,26 +548,50 @@ g2d_get_ver(int fd, struct nx_g2d_ver *ver)
 }
 
 drm_public
-struct nx_g2d_ctx *nexell_g2d_alloc(int fd, int *major, int *minor)
+struct nx_g2d_dev *nexell_g2d_dev_open(int fd, unsigned int flags,
+				       int *major, int *minor)
 {
-	struct nx_g2d_ctx *ctx;
+	struct nx_g2d_dev *dev;
 	struct nx_g2d_ver ver = { 0 };
 	int ret;
 
-	ret = g2d_get_ver(fd, &ver);
-	if (ret || ver.major != NX_G2D_DRIVER_VER_MAJOR) {
-		D_ERROR("%s() Not Support VERSION GFX:%d-%d, DRIVER:%d-%d\n",
-			__func__,
-			NX_G2D_DRIVER_VER_MAJOR, NX_G2D_DRIVER_VER_MINOR,
-			ver.major, ver.minor);
-		return NULL;
+	if (flags & NX_G2D_ALLOC_SOFTWARE) {
+		ver.major = NX_G2D_DRIVER_VER_MAJOR;
+		ver.minor = NX_G2D_DRIVER_VER_MINOR;
+	} else {
+		ret = g2d_get_ver(fd, &ver);
+		if (ret || ver.major != NX_G2D_DRIVER_VER_MAJOR) {
+			D_ERROR("%s() Not Support VERSION GFX:%d-%d, DRIVER:%d-%d\n",
+				__func__,
+				NX_G2D_DRIVER_VER_MAJOR, NX_G2D_DRIVER_VER_MINOR,
+				ver.major, ver.minor);
+			return NULL;
+		}
 	}
 
-	ctx = calloc(1, sizeof(*ctx));
-	if (!ctx)
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
 		return NULL;
 
-	ctx->fd = fd;
+	dev->fd = fd;
+	dev->major = ver.major;
+	dev->minor = ver.minor;
+	dev->refcount = 1;
+	pthread_mutex_init(&dev->sw_lock, NULL);
+	pthread_mutex_init(&dev->import_lock, NULL);
+	pthread_mutex_init(&dev->ctx_lock, NULL);
+
+	if (flags & NX_G2D_ALLOC_SOFTWARE) {
+		dev->sw = nx_g2d_sw_create();
+		if (!dev->sw) {
+			pthread_mutex_destroy(&dev->ctx_lock);
+			pthread_mutex_destroy(&dev->import_lock);
+			pthread_mutex_destroy(&dev->sw_lock);
+			free(dev);
+			return NULL;
+		}
+		D_DEBUG("software G2D engine\n");
+	}
 
 	if (major)
 		*major = ver.major;
@@ -331,87 +599,1348 @@ struct nx_g2d_ctx *nexell_g2d_alloc(int fd, int *major, int *minor)
 	if (minor)
 		*minor = ver.minor;
 
+	return dev;
+}
+
+drm_public
+void nexell_g2d_dev_close(struct nx_g2d_dev *dev)
+{
+	if (__atomic_sub_fetch(&dev->refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	nx_g2d_import_release_all(dev);
+	pthread_mutex_destroy(&dev->ctx_lock);
+	pthread_mutex_destroy(&dev->import_lock);
+
+	if (dev->sw)
+		nx_g2d_sw_destroy(dev->sw);
+	pthread_mutex_destroy(&dev->sw_lock);
+	free(dev);
+}
+
+drm_public
+struct nx_g2d_ctx *nexell_g2d_ctx_create(struct nx_g2d_dev *dev)
+{
+	struct nx_g2d_ctx *ctx;
+	const char *env;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	__atomic_add_fetch(&dev->refcount, 1, __ATOMIC_ACQ_REL);
+	ctx->dev = dev;
+	ctx->id = __atomic_fetch_add(&dev->contexts, 1, __ATOMIC_RELAXED);
+
+	env = getenv("NEXELL_G2D_CPU_THRESHOLD");
+	nexell_g2d_set_cpu_threshold(ctx, env && *env ?
+				     atoi(env) : NX_G2D_CPU_THRESHOLD);
+
+	nx_g2d_stats_init(ctx);
+	nx_g2d_capture_init(ctx);
+
+	pthread_mutex_lock(&dev->ctx_lock);
+	ctx->next = dev->ctx_list;
+	dev->ctx_list = ctx;
+	pthread_mutex_unlock(&dev->ctx_lock);
+
+	return ctx;
+}
+
+drm_public
+struct nx_g2d_ctx *nexell_g2d_alloc_flags(int fd, unsigned int flags,
+					  int *major, int *minor)
+{
+	struct nx_g2d_dev *dev;
+	struct nx_g2d_ctx *ctx;
+
+	dev = nexell_g2d_dev_open(fd, flags, major, minor);
+	if (!dev)
+		return NULL;
+
+	/* the context holds the only device reference */
+	ctx = nexell_g2d_ctx_create(dev);
+	nexell_g2d_dev_close(dev);
+
 	return ctx;
 }
 
+drm_public
+struct nx_g2d_ctx *nexell_g2d_alloc(int fd, int *major, int *minor)
+{
+	const char *backend = getenv("NEXELL_G2D_BACKEND");
+	unsigned int flags = 0;
+
+	if (backend && (!strcmp(backend, "sw") || !strcmp(backend, "software")))
+		flags |= NX_G2D_ALLOC_SOFTWARE;
+
+	return nexell_g2d_alloc_flags(fd, flags, major, minor);
+}
+
+drm_public
+struct nx_g2d_dev *nexell_g2d_get_dev(struct nx_g2d_ctx *ctx)
+{
+	return ctx->dev;
+}
+
 drm_public
 void nexell_g2d_free(struct nx_g2d_ctx *ctx)
 {
+	struct nx_g2d_dev *dev = ctx->dev;
+	struct nx_g2d_ctx **p;
+
+	nexell_g2d_list_free(nexell_g2d_list_end(ctx));
+	nexell_g2d_batch_end(ctx);
+	nexell_g2d_ring_end(ctx);
+	nexell_g2d_hybrid_end(ctx);
+
+	/* imports closed from now on are no longer checked against it */
+	nexell_g2d_wait(ctx, ctx->serial);
+
+	pthread_mutex_lock(&dev->ctx_lock);
+	for (p = &dev->ctx_list; *p != ctx; p = &(*p)->next)
+		;
+	*p = ctx->next;
+	pthread_mutex_unlock(&dev->ctx_lock);
+
+	nx_g2d_stats_free(ctx);
+	nx_g2d_capture_free(ctx);
+	if (ctx->user_sw)
+		nx_g2d_sw_destroy(ctx->user_sw);
+	nexell_g2d_dev_close(ctx->dev);
 	free(ctx);
 }
 
 drm_public
-int nexell_g2d_fillrect(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img)
+int nexell_g2d_bind(struct nx_g2d_ctx *ctx, unsigned int handle,
+		    void *addr, unsigned long size)
 {
-	struct nx_g2d_cmd *cmd = &ctx->cmd;
-	struct nx_g2d_image_obj *dst = &img->dst;
+	struct nx_g2d_dev *dev = ctx->dev;
+	int ret;
 
-	g2d_op_initialize(cmd, img);
+	if (!dev->sw)
+		return 0;
 
-	g2d_op_blend_write_mask(cmd, 0xf);
-	g2d_op_blend_rop_mode(cmd, 0, false);
-	g2d_op_blend_color(cmd, img->blendcolor, false);
+	/* the submission thread may be rendering with the bindings */
+	if (ctx->ring)
+		nx_g2d_ring_drain(ctx->ring);
 
-	g2d_op_image_size(cmd, img->width, img->height);
-	g2d_op_solid_color(cmd, img->fillcolor, true);
+	pthread_mutex_lock(&dev->sw_lock);
+	ret = nx_g2d_sw_bind(dev->sw, handle, addr, size);
+	pthread_mutex_unlock(&dev->sw_lock);
 
-	g2d_op_src_read_enb(cmd, false);
+	return ret;
+}
 
-	g2d_op_dst_image(cmd, img->width, dst->pitch,
-			dst->pixelorder, dst->pixelformat,
-			dst->pixelbyte);
-	g2d_op_dst_read_enb(cmd, false);
-	g2d_op_dst_dither(cmd, 0, 0, DITHER(img->dst.pixelbyte));
+drm_public
+void nexell_g2d_unbind(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	struct nx_g2d_dev *dev = ctx->dev;
+
+	if (!dev->sw)
+		return;
 
-	return g2d_submit(ctx, cmd);
+	/* queued commands of the context may still render with it */
+	if (g2d_handle_busy(ctx, handle))
+		nexell_g2d_sync(ctx);
+	else if (ctx->ring)
+		nx_g2d_ring_drain(ctx->ring);
+
+	pthread_mutex_lock(&dev->sw_lock);
+	nx_g2d_sw_unbind(dev->sw, handle);
+	pthread_mutex_unlock(&dev->sw_lock);
 }
 
-drm_public int
-nexell_g2d_blit(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img)
+drm_public
+void nexell_g2d_set_cpu_threshold(struct nx_g2d_ctx *ctx, int pixels)
 {
-	struct nx_g2d_cmd *cmd = &ctx->cmd;
-	struct nx_g2d_image_obj *src = &img->src;
-	struct nx_g2d_image_obj *dst = &img->dst;
+	ctx->cpu_fill_threshold = pixels;
+	ctx->cpu_copy_threshold = pixels;
+}
 
-	int src_rgb = GL_BLEND_SRC_ALPHA;
-	int dst_rgb = GL_BLEND_ONE_MINUS_SRC_ALPHA;
-	int src_alpha = GL_BLEND_SRC_ALPHA;
-	int dst_alpha = GL_BLEND_ONE_MINUS_SRC_ALPHA;
-	int equat_rgb = GL_EQUATION_FUNC_ADD;
-	int equat_alpha = GL_EQUATION_FUNC_ADD;
+drm_public
+int nexell_g2d_batch_begin(struct nx_g2d_ctx *ctx, int size,
+			   unsigned int flags)
+{
+	struct nx_g2d_cmd *batch;
+	const char *env;
 
-	g2d_op_initialize(cmd, img);
+	if (ctx->batching)
+		return 0;
 
-	g2d_op_blend_write_mask(cmd, 0xf);
-	g2d_op_blend_rop_mode(cmd, 0, false);
-	g2d_op_blend_alpha(cmd,
-			src_rgb, dst_rgb,
-			src_alpha, dst_alpha,
-			equat_rgb, equat_alpha);
-	g2d_op_blend_color(cmd, img->blendcolor, false); /* true */
+	if (!size) {
+		env = getenv("NEXELL_G2D_BATCH");
+		size = env && *env ? atoi(env) : NX_G2D_BATCH_SIZE;
+	}
 
-	g2d_op_image_size(cmd, img->width, img->height);
+	/* batching disabled, keep submitting every command */
+	if (size <= 1)
+		return 0;
 
-	/* must be set false */
-	g2d_op_solid_color(cmd, img->fillcolor, false);
+	batch = calloc(size, sizeof(*batch));
+	if (!batch)
+		return -ENOMEM;
 
-	g2d_op_src_image(cmd, img->width, src->pitch,
-			 src->pixelorder, src->pixelformat,
-			 src->pixelbyte);
-	g2d_op_src_alpha(cmd, 0, 0);
-	g2d_op_src_read_enb(cmd, true);
+	ctx->batch = batch;
+	ctx->batch_size = size;
+	ctx->batch_count = 0;
+	ctx->batch_flags = flags;
+	ctx->batching = true;
 
-	g2d_op_dst_image(cmd, img->width, dst->pitch,
-			 dst->pixelorder, dst->pixelformat,
-			 dst->pixelbyte);
-	g2d_op_dst_read_enb(cmd, false);
-	g2d_op_dst_dither(cmd, 0, 0, DITHER(img->dst.pixelbyte));
+	D_DEBUG("command batch %d%s\n", size,
+		flags & NX_G2D_BATCH_SEQUENTIAL ? " (sequential)" : "");
 
-	return g2d_submit(ctx, cmd);
+	return 0;
 }
 
 drm_public
-int nexell_g2d_sync(struct nx_g2d_ctx *ctx)
+int nexell_g2d_batch_flush(struct nx_g2d_ctx *ctx)
+{
+	return g2d_batch_flush(ctx);
+}
+
+drm_public
+int nexell_g2d_batch_end(struct nx_g2d_ctx *ctx)
+{
+	int ret;
+
+	if (!ctx->batching)
+		return 0;
+
+	ret = g2d_batch_flush(ctx);
+
+	free(ctx->batch);
+	ctx->batch = NULL;
+	ctx->batch_size = 0;
+	ctx->batching = false;
+
+	return ret;
+}
+
+drm_public
+int nexell_g2d_batch_probe(struct nx_g2d_ctx *ctx)
+{
+#ifdef DRM_IOCTL_NX_G2D_DMA_EXEC_LIST
+	struct nx_g2d_cmd_list arg = { 0 };
+#endif
+
+	if (ctx->dev->sw)
+		return 0;
+
+#ifdef DRM_IOCTL_NX_G2D_DMA_EXEC_LIST
+	/* an empty list, rejected by kernels without the ioctl */
+	return !drmIoctl(ctx->dev->fd, DRM_IOCTL_NX_G2D_DMA_EXEC_LIST, &arg);
+#else
+	return 0;
+#endif
+}
+
+drm_public
+int nexell_g2d_ring_begin(struct nx_g2d_ctx *ctx, int size)
 {
-	return g2d_sync(ctx, &ctx->cmd);
+	const char *env;
+
+	if (ctx->ring)
+		return 0;
+
+	if (!size) {
+		env = getenv("NEXELL_G2D_RING");
+		size = env && *env ? atoi(env) : 0;
+	}
+
+	/* submit from the caller */
+	if (size <= 0)
+		return 0;
+
+	if (size == 1)
+		size = NX_G2D_RING_SIZE;
+
+	ctx->ring = nx_g2d_ring_create(ctx, size);
+	if (!ctx->ring)
+		return -ENOMEM;
+
+	return 0;
+}
+
+drm_public
+int nexell_g2d_ring_end(struct nx_g2d_ctx *ctx)
+{
+	int ret;
+
+	if (!ctx->ring)
+		return 0;
+
+	ret = nx_g2d_ring_drain(ctx->ring);
+
+	nx_g2d_ring_destroy(ctx->ring);
+	ctx->ring = NULL;
+
+	return ret;
+}
+
+drm_public
+int nexell_g2d_hybrid_begin(struct nx_g2d_ctx *ctx, int threads)
+{
+	const char *env;
+
+	if (ctx->pool)
+		return 0;
+
+	if (!threads) {
+		env = getenv("NEXELL_G2D_HYBRID");
+		threads = env && *env ? atoi(env) : 0;
+	}
+
+	/* G2D only */
+	if (threads <= 0)
+		return 0;
+
+	ctx->pool = nx_g2d_pool_create(threads);
+	if (!ctx->pool)
+		return -ENOMEM;
+
+	env = getenv("NEXELL_G2D_HYBRID_PIXELS");
+	ctx->hybrid_pixels = env && *env ? atoi(env) : NX_G2D_HYBRID_PIXELS;
+	ctx->hybrid_ratio = NX_G2D_HYBRID_RATIO;
+
+	return 0;
+}
+
+drm_public
+void nexell_g2d_hybrid_end(struct nx_g2d_ctx *ctx)
+{
+	if (!ctx->pool)
+		return;
+
+	nx_g2d_pool_destroy(ctx->pool);
+	ctx->pool = NULL;
+}
+
+/* byte offset of a pixel in a buffer */
+#define	OFFSET(o, x, y)	((o)->offset + (y) * (o)->pitch + (x) * (o)->pixelbyte)
+
+#ifdef NX_G2D_STATS
+static inline void
+g2d_stat_op(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img, bool blit,
+	    int width, int height)
+{
+	__u64 pixels = (__u64)width * height;
+
+	if (blit) {
+		ctx->stats.blits++;
+		ctx->stats.bytes += pixels *
+			(img->src.pixelbyte + img->dst.pixelbyte);
+	} else {
+		ctx->stats.fills++;
+		ctx->stats.bytes += pixels * img->dst.pixelbyte;
+	}
+	ctx->stats.pixels += pixels;
+}
+#else
+#define g2d_stat_op(ctx, img, blit, width, height)	do { } while (0)
+#endif
+
+/* 'serial' is the last queued one before the operation */
+static inline void
+g2d_trace_op(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img, bool blit,
+	     int x, int y, int width, int height, __u64 start, __u64 serial)
+{
+	G2D_TRACE(.type = blit ? NX_G2D_TRACE_BLIT : NX_G2D_TRACE_FILL,
+		  .ctx = ctx->id, .ts = start,
+		  .serial = ctx->serial != serial ? ctx->serial : 0,
+		  .src = blit ? img->src.handle : 0, .dst = img->dst.handle,
+		  .x = x, .y = y, .w = width, .h = height);
+}
+
+/*
+ * Small operations on idle, CPU mapped buffers are cheaper on the CPU
+ * than a G2D command. Busy buffers keep going to the G2D to stay ordered.
+ */
+static bool
+g2d_cpu_fill(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	     __u32 dst_offset, int width, int height)
+{
+	struct nx_g2d_image_obj *dst = &img->dst;
+
+	if (!dst->vaddr || width * height > ctx->cpu_fill_threshold ||
+	    ctx->list)
+		return false;
+
+	if (img->blend.enable || img->blend.rop_enable)
+		return false;
+
+	if (!g2d_cpu_idle(ctx, dst->handle))
+		return false;
+
+	nx_g2d_cpu_fill((unsigned char *)dst->vaddr + dst_offset,
+			dst->pitch, width, height, dst->pixelbyte,
+			nx_g2d_sw_color(dst->pixelformat, dst->pixelorder,
+					img->fillcolor));
+	G2D_STAT_ADD(ctx, cpu_ops, 1);
+
+	return true;
+}
+
+/*
+ * CPU copy within one buffer: lines from the bottom one up when moving
+ * down or right, and memmove() per line, so that any overlap is safe.
+ */
+static void
+g2d_cpu_move(struct nx_g2d_image_obj *dst, __u32 src_offset,
+	     __u32 dst_offset, int width, int height)
+{
+	unsigned char *base = dst->vaddr;
+	int linesize = width * dst->pixelbyte;
+	int y;
+
+	if (dst_offset > src_offset) {
+		for (y = height - 1; y >= 0; y--)
+			memmove(base + dst_offset + y * dst->pitch,
+				base + src_offset + y * dst->pitch, linesize);
+	} else {
+		for (y = 0; y < height; y++)
+			memmove(base + dst_offset + y * dst->pitch,
+				base + src_offset + y * dst->pitch, linesize);
+	}
+}
+
+static bool
+g2d_cpu_copy(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	     __u32 src_offset, __u32 dst_offset, int width, int height)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+
+	if (!src->vaddr || !dst->vaddr ||
+	    width * height > ctx->cpu_copy_threshold || ctx->list)
+		return false;
+
+	if (img->blend.enable || img->blend.force_alpha ||
+	    img->blend.rop_enable)
+		return false;
+
+	if (src->pixelformat != dst->pixelformat ||
+	    src->pixelorder != dst->pixelorder)
+		return false;
+
+	if (!g2d_cpu_idle(ctx, src->handle) ||
+	    !g2d_cpu_idle(ctx, dst->handle))
+		return false;
+
+	/* possibly over its own source */
+	if (src->handle == dst->handle) {
+		if (src->pitch != dst->pitch)
+			return false;
+		g2d_cpu_move(dst, src_offset, dst_offset, width, height);
+		G2D_STAT_ADD(ctx, cpu_ops, 1);
+		return true;
+	}
+
+	nx_g2d_cpu_copy((unsigned char *)dst->vaddr + dst_offset, dst->pitch,
+			(unsigned char *)src->vaddr + src_offset, src->pitch,
+			width * dst->pixelbyte, height);
+	G2D_STAT_ADD(ctx, cpu_ops, 1);
+
+	return true;
+}
+
+static bool
+g2d_blend_dst_read(struct nx_g2d_blend *blend)
+{
+	if (blend->rop_enable) {
+		switch (blend->rop) {
+		case GL_BLEND_ROP_CLEAR:
+		case GL_BLEND_ROP_COPY_INVERTED:
+		case GL_BLEND_ROP_COPY:
+		case GL_BLEND_ROP_SET:
+			return false;
+		}
+		return true;
+	}
+
+	if (!blend->enable)
+		return false;
+
+	switch (blend->src_rgb) {
+	case GL_BLEND_DST_COLOR:
+	case GL_BLEND_ONE_MINUS_DST_COLOR:
+	case GL_BLEND_DST_ALPHA:
+	case GL_BLEND_ONE_MINUS_DST_ALPHA:
+	case GL_BLEND_SRC_ALPHA_SATURATE:
+		return true;
+	}
+
+	return blend->dst_rgb != GL_BLEND_ZERO ||
+		blend->dst_alpha != GL_BLEND_ZERO;
+}
+
+/* BLEND_EQUAT_ALPHA and BLEND_COLOR, shared by fills and blits */
+static void
+g2d_encode_blend(struct nx_g2d_cmd *cmd, struct nx_g2d_image *img)
+{
+	struct nx_g2d_blend *blend = &img->blend;
+
+	int src_rgb = GL_BLEND_SRC_ALPHA;
+	int dst_rgb = GL_BLEND_ONE_MINUS_SRC_ALPHA;
+	int src_alpha = GL_BLEND_SRC_ALPHA;
+	int dst_alpha = GL_BLEND_ONE_MINUS_SRC_ALPHA;
+	int equat_rgb = GL_EQUATION_FUNC_ADD;
+	int equat_alpha = GL_EQUATION_FUNC_ADD;
+
+	if (blend->enable) {
+		src_rgb = blend->src_rgb;
+		dst_rgb = blend->dst_rgb;
+		src_alpha = blend->src_alpha;
+		dst_alpha = blend->dst_alpha;
+		equat_rgb = blend->equat_rgb;
+		equat_alpha = blend->equat_alpha;
+	}
+
+	g2d_op_blend_write_mask(cmd, 0xf);
+	g2d_op_blend_rop_mode(cmd, blend->rop_enable ? blend->rop : 0,
+			      blend->rop_enable);
+	g2d_op_blend_alpha(cmd,
+			src_rgb, dst_rgb,
+			src_alpha, dst_alpha,
+			equat_rgb, equat_alpha);
+	g2d_op_blend_color(cmd, img->blendcolor,
+			   blend->enable && !blend->rop_enable);
+}
+
+static void
+g2d_encode_fill(struct nx_g2d_cmd *cmd, struct nx_g2d_image *img)
+{
+	struct nx_g2d_image_obj *dst = &img->dst;
+	struct nx_g2d_blend *blend = &img->blend;
+
+	g2d_op_initialize(cmd, img);
+
+	g2d_encode_blend(cmd, img);
+
+	g2d_op_image_size(cmd, img->width, img->height);
+	g2d_op_solid_color(cmd, img->fillcolor, true);
+
+	g2d_op_src_read_enb(cmd, false);
+
+	g2d_op_dst_image(cmd, img->width, dst->pitch,
+			dst->pixelorder, dst->pixelformat,
+			dst->pixelbyte);
+	g2d_op_dst_read_enb(cmd, g2d_blend_dst_read(blend));
+	/* a solid color is not dithered, CPU and G2D fills must match */
+	g2d_op_dst_dither(cmd, 0, 0, 0);
+}
+
+static void
+g2d_encode_blit(struct nx_g2d_cmd *cmd, struct nx_g2d_image *img)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	struct nx_g2d_blend *blend = &img->blend;
+
+	g2d_op_initialize(cmd, img);
+
+	g2d_encode_blend(cmd, img);
+
+	g2d_op_image_size(cmd, img->width, img->height);
+
+	/* must be set false */
+	g2d_op_solid_color(cmd, img->fillcolor, false);
+
+	g2d_op_src_image(cmd, img->width, src->pitch,
+			 src->pixelorder, src->pixelformat,
+			 src->pixelbyte);
+	g2d_op_src_alpha(cmd, blend->alpha, blend->force_alpha ? 1 : 0);
+	g2d_op_src_read_enb(cmd, true);
+
+	g2d_op_dst_image(cmd, img->width, dst->pitch,
+			 dst->pixelorder, dst->pixelformat,
+			 dst->pixelbyte);
+	g2d_op_dst_read_enb(cmd, g2d_blend_dst_read(blend));
+	g2d_op_dst_dither(cmd, 0, 0,
+			  DITHER(src->pixelformat, dst->pixelformat));
+}
+
+/*
+ * Rewrites the registers that change per rectangle in an encoded command:
+ * buffer offsets, SIZE and the line sizes.
+ */
+static void
+g2d_cmd_patch(struct nx_g2d_cmd *cmd, struct nx_g2d_image *img,
+	      __u32 src_offset, __u32 dst_offset, int width, int height)
+{
+	cmd->src.offset = src_offset;
+	cmd->dst.offset = dst_offset;
+
+	cmd->cmd[NX_G2D_CMD_SIZE] =
+		BITS(height - 1, 12, 16) | BITS(width - 1, 12, 0);
+	cmd->cmd[NX_G2D_CMD_DST_BLKSIZE] = width * img->dst.pixelbyte;
+
+	if (cmd->cmd_mask & BIT(NX_G2D_CMD_SRC_BLKSIZE))
+		cmd->cmd[NX_G2D_CMD_SRC_BLKSIZE] = width * img->src.pixelbyte;
+}
+
+/*
+ * Tiling of a copy within one buffer. The G2D copies from the top line to
+ * the bottom one, left to right, so a copy moving down or right over its
+ * own source would read lines or pixels it has already overwritten. These
+ * copies are split into tiles that do not overlap their own source,
+ * queued so that no tile overwrites the source of a later one:
+ *
+ *	moving down	: bands of dy lines, from the bottom band up
+ *	moving right	: columns of dx pixels, from the right column
+ *			  (same lines only)
+ *
+ * Moving up or left in the engine order is safe as is.
+ *
+ * A copy takes height / dy (or width / dx) commands, a 1 line scroll of
+ * 1080 lines is 1080 commands and as many ioctls without the list ioctl.
+ * Steps below NX_G2D_OVERLAP_MIN are done by the CPU when the buffer is
+ * mapped, see g2d_cpu_overlap(), the tiles queued otherwise are counted
+ * in the overlap_tiles statistics.
+ */
+static void
+g2d_tiles_overlap(struct nx_g2d_image *img, __u32 src_offset,
+		  __u32 dst_offset, int width, int height,
+		  int *tile_w, int *tile_h, bool *up, bool *left)
+{
+	struct nx_g2d_image_obj *dst = &img->dst;
+	long long delta = (long long)dst_offset - src_offset;
+	int pitch = dst->pitch;
+	int dy, dx;
+
+	/*
+	 * Both rectangles lie within the lines of the buffer, so the
+	 * displacement with the smallest horizontal part is the real one
+	 * whenever the rectangles can overlap.
+	 */
+	dy = (delta + (delta < 0 ? -pitch : pitch) / 2) / pitch;
+	dx = (delta - (long long)dy * pitch) / dst->pixelbyte;
+
+	if (dy >= height || dy <= -height || dx >= width || dx <= -width)
+		return;
+
+	if (dy > 0) {
+		*tile_h = dy < *tile_h ? dy : *tile_h;
+		*up = true;
+	} else if (!dy && dx > 0) {
+		*tile_w = dx < *tile_w ? dx : *tile_w;
+		*left = true;
+	}
+}
+
+/*
+ * Copy over its own source with a step too small for the G2D tiling,
+ * done by the CPU once the G2D is done with the buffer. Returns false
+ * if the copy can't be done by the CPU.
+ */
+static bool
+g2d_cpu_overlap(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+		__u32 src_offset, __u32 dst_offset, int width, int height,
+		int *ret)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+
+	if (!dst->vaddr || ctx->list)
+		return false;
+
+	if (img->blend.enable || img->blend.force_alpha ||
+	    img->blend.rop_enable)
+		return false;
+
+	if (src->pixelformat != dst->pixelformat ||
+	    src->pixelorder != dst->pixelorder)
+		return false;
+
+	if (g2d_handle_busy_others(ctx, dst->handle))
+		return false;
+
+	/* only the commands up to the last one using the buffer */
+	*ret = nexell_g2d_wait(ctx, g2d_handle_serial(ctx, dst->handle));
+	if (*ret < 0)
+		return true;
+
+	g2d_cpu_move(dst, src_offset, dst_offset, width, height);
+	G2D_STAT_ADD(ctx, cpu_ops, 1);
+
+	return true;
+}
+
+/*
+ * Queues the command template for a rectangle. Rectangles over the SIZE
+ * limit are split into full-width bands of NX_G2D_MAX_SIZE lines, which
+ * keep the DRAM accesses in long bursts, and the bands into columns only
+ * when wider than the limit. Copies over their own source are tiled as
+ * g2d_tiles_overlap() sets. The tiles of one operation are queued as one
+ * batch.
+ */
+static int
+g2d_cmd_tiles(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	      struct nx_g2d_cmd *tmpl, __u32 src_offset, __u32 dst_offset,
+	      int width, int height)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	bool src_rd = tmpl->cmd[NX_G2D_CMD_SRC_CTRL] & BIT(6);
+	int tile_w = NX_G2D_MAX_SIZE, tile_h = NX_G2D_MAX_SIZE;
+	bool up = false, left = false;
+	struct nx_g2d_cmd tiles[NX_G2D_TILE_CMDS], *cmd;
+	bool stack;
+	int cols, rows, i, n = 0, ret = 0;
+
+	if (src_rd && src->handle == dst->handle && src->pitch == dst->pitch)
+		g2d_tiles_overlap(img, src_offset, dst_offset, width, height,
+				  &tile_w, &tile_h, &up, &left);
+
+	if (((up && tile_h < NX_G2D_OVERLAP_MIN) ||
+	     (left && tile_w < NX_G2D_OVERLAP_MIN)) &&
+	    g2d_cpu_overlap(ctx, img, src_offset, dst_offset,
+			    width, height, &ret))
+		return ret;
+
+	cols = (width + tile_w - 1) / tile_w;
+	rows = (height + tile_h - 1) / tile_h;
+
+	if (up || left)
+		G2D_STAT_ADD(ctx, overlap_tiles, cols * rows);
+
+	/* unbatched, the tiles are still submitted a few at a time */
+	stack = cols * rows > 1 && !ctx->batching && !ctx->list;
+
+	for (i = 0; i < cols * rows; i++) {
+		int c = left ? cols - 1 - i % cols : i % cols;
+		int r = up ? rows - 1 - i / cols : i / cols;
+		int x = c * tile_w;
+		int y = r * tile_h;
+		int w = width - x < tile_w ? width - x : tile_w;
+		int h = height - y < tile_h ? height - y : tile_h;
+
+		cmd = stack ? &tiles[n] : g2d_cmd_get(ctx);
+		*cmd = *tmpl;
+		g2d_cmd_patch(cmd, img,
+			      src_offset + y * src->pitch + x * src->pixelbyte,
+			      dst_offset + y * dst->pitch + x * dst->pixelbyte,
+			      w, h);
+
+		if (!stack) {
+			ret = g2d_cmd_commit(ctx, cmd);
+		} else {
+			COMMAND(cmd, 1, NX_G2D_CMD_RUN);
+			g2d_cmd_serial(ctx, cmd);
+			if (++n == NX_G2D_TILE_CMDS || i == cols * rows - 1) {
+				ret = g2d_submit_done(ctx, tiles, n);
+				n = 0;
+			}
+		}
+		if (ret < 0)
+			break;
+	}
+
+	return ret;
+}
+
+static inline bool
+g2d_hybrid_size(struct nx_g2d_ctx *ctx, int width, int height)
+{
+	return ctx->pool && width * height >= ctx->hybrid_pixels;
+}
+
+/*
+ * Hybrid execution of a large fill or same format copy: the first rows
+ * go to the G2D, the remaining rows are split among the CPU workers and
+ * the caller waits for the workers. The G2D rows retire like any queued
+ * command, the destination stays busy until then. Only operations started
+ * with the G2D idle wait for their own rows, to measure them: the G2D
+ * share follows the throughput measured on each side and stays within
+ * [1/16, 15/16] so that both sides keep being measured.
+ */
+static bool
+g2d_hybrid(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	   struct nx_g2d_cmd *tmpl, __u32 src_offset, __u32 dst_offset,
+	   int width, int height, int *ret)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	struct nx_g2d_band bands[NX_G2D_HYBRID_THREADS];
+	bool src_rd = tmpl->cmd[NX_G2D_CMD_SRC_CTRL] & BIT(6);
+	int hw_rows, cpu_rows, num, rows, i, y;
+	unsigned int pixel = 0;
+	__u64 start, serial, hw_ns = 0, cpu_ns, target;
+	bool idle;
+	int ratio;
+
+	if (!g2d_hybrid_size(ctx, width, height) || ctx->list)
+		return false;
+
+	if (!dst->vaddr || img->blend.enable || img->blend.force_alpha ||
+	    img->blend.rop_enable)
+		return false;
+
+	if (src_rd && (!src->vaddr || src->handle == dst->handle ||
+		       src->pixelformat != dst->pixelformat ||
+		       src->pixelorder != dst->pixelorder))
+		return false;
+
+	/* the CPU must not race with queued commands on the buffers */
+	if (!g2d_cpu_idle(ctx, dst->handle) ||
+	    (src_rd && !g2d_cpu_idle(ctx, src->handle)))
+		return false;
+
+	hw_rows = height * ctx->hybrid_ratio / 1024;
+	cpu_rows = height - hw_rows;
+	if (!hw_rows || !cpu_rows)
+		return false;
+
+	if (!src_rd)
+		pixel = nx_g2d_sw_color(dst->pixelformat, dst->pixelorder,
+					img->fillcolor);
+
+	G2D_STAT_ADD(ctx, hybrid_ops, 1);
+
+	idle = ctx->serial_done == ctx->serial;
+	start = nx_g2d_time_ns();
+
+	/* submitted at once, so that the G2D runs along with the workers */
+	*ret = g2d_cmd_tiles(ctx, img, tmpl, src_offset, dst_offset,
+			     width, hw_rows);
+	if (!*ret)
+		*ret = g2d_batch_flush(ctx);
+	if (*ret < 0)
+		return true;
+
+	serial = ctx->serial;
+
+	num = nx_g2d_pool_threads(ctx->pool);
+	if (num > cpu_rows)
+		num = cpu_rows;
+
+	for (i = 0, y = hw_rows; i < num; i++, y += rows) {
+		struct nx_g2d_band *band = &bands[i];
+
+		rows = cpu_rows / num + (i < cpu_rows % num);
+
+		band->dst = (unsigned char *)dst->vaddr + dst_offset +
+			    y * dst->pitch;
+		band->dst_pitch = dst->pitch;
+		band->src = src_rd ? (unsigned char *)src->vaddr + src_offset +
+				     y * src->pitch : NULL;
+		band->src_pitch = src->pitch;
+		band->width = width;
+		band->height = rows;
+		band->pixelbyte = dst->pixelbyte;
+		band->pixel = pixel;
+	}
+
+	nx_g2d_pool_run(ctx->pool, bands, num);
+
+	/* nothing else queued since idle, only the rows of this operation */
+	if (idle) {
+		*ret = nexell_g2d_wait(ctx, serial);
+		hw_ns = nx_g2d_time_ns() - start;
+	}
+
+	/* the bands are on the stack, wait even if the G2D failed */
+	cpu_ns = nx_g2d_pool_wait(ctx->pool) - start;
+
+	if (*ret < 0 || !idle || !hw_ns || !cpu_ns)
+		return true;
+
+	/* G2D share at which both sides would end together */
+	target = (__u64)hw_rows * cpu_ns * 1024 /
+		 ((__u64)hw_rows * cpu_ns + (__u64)cpu_rows * hw_ns);
+
+	ratio = (3 * ctx->hybrid_ratio + (int)target) / 4;
+	if (ratio < 64)
+		ratio = 64;
+	if (ratio > 960)
+		ratio = 960;
+
+	if (ratio != ctx->hybrid_ratio)
+		D_DEBUG("hybrid ratio %d/1024\n", ratio);
+	ctx->hybrid_ratio = ratio;
+
+	return true;
+}
+
+/*
+ * Blit from user memory (NX_G2D_BUF_TYPE_USER) into a CPU mapped
+ * destination, once the G2D is done with it. Plain copies use the CPU
+ * kernel, the others run the encoded command on a software engine with
+ * the user memory and the destination bound, so blending and format
+ * conversion match the G2D.
+ */
+static int
+g2d_user_blit(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	      struct nx_g2d_cmd *tmpl, __u32 src_offset, __u32 dst_offset,
+	      int width, int height)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	struct nx_g2d_cmd cmd;
+	int x, y, w, h, ret;
+
+	/* the user memory may be gone on replay */
+	if (ctx->list || !src->vaddr || !dst->vaddr)
+		return -EINVAL;
+
+	G2D_STAT_ADD(ctx, user_blits, 1);
+
+	/* no G2D route for user memory, and other contexts can't be waited */
+	if (g2d_handle_busy_others(ctx, dst->handle)) {
+		D_ERROR("%s() handle 0x%x busy in another context\n",
+			__func__, dst->handle);
+		return -EBUSY;
+	}
+
+	ret = nexell_g2d_wait(ctx, g2d_handle_serial(ctx, dst->handle));
+	if (ret < 0)
+		return ret;
+
+	if (!img->blend.enable && !img->blend.force_alpha &&
+	    !img->blend.rop_enable &&
+	    src->pixelformat == dst->pixelformat &&
+	    src->pixelorder == dst->pixelorder) {
+		nx_g2d_cpu_copy((unsigned char *)dst->vaddr + dst_offset,
+				dst->pitch,
+				(unsigned char *)src->vaddr + src_offset,
+				src->pitch, width * dst->pixelbyte, height);
+		return 0;
+	}
+
+	if (!ctx->user_sw) {
+		ctx->user_sw = nx_g2d_sw_create();
+		if (!ctx->user_sw)
+			return -ENOMEM;
+	}
+
+	ret = nx_g2d_sw_bind(ctx->user_sw, NX_G2D_USER_HANDLE, src->vaddr,
+			     src_offset + (height - 1) * src->pitch +
+			     width * src->pixelbyte);
+	if (!ret)
+		ret = nx_g2d_sw_bind(ctx->user_sw, dst->handle, dst->vaddr,
+				     dst_offset + (height - 1) * dst->pitch +
+				     width * dst->pixelbyte);
+
+	for (y = 0; y < height && !ret; y += NX_G2D_MAX_SIZE) {
+		for (x = 0; x < width && !ret; x += NX_G2D_MAX_SIZE) {
+			w = width - x < NX_G2D_MAX_SIZE ?
+				width - x : NX_G2D_MAX_SIZE;
+			h = height - y < NX_G2D_MAX_SIZE ?
+				height - y : NX_G2D_MAX_SIZE;
+
+			cmd = *tmpl;
+			cmd.src.handle = NX_G2D_USER_HANDLE;
+			g2d_cmd_patch(&cmd, img,
+				src_offset + y * src->pitch +
+				x * src->pixelbyte,
+				dst_offset + y * dst->pitch +
+				x * dst->pixelbyte, w, h);
+			COMMAND(&cmd, 1, NX_G2D_CMD_RUN);
+
+			ret = nx_g2d_sw_exec(ctx->user_sw, &cmd);
+		}
+	}
+
+	nx_g2d_sw_unbind(ctx->user_sw, dst->handle);
+	nx_g2d_sw_unbind(ctx->user_sw, NX_G2D_USER_HANDLE);
+
+	return ret;
+}
+
+static int
+g2d_fillrect(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img)
+{
+	struct nx_g2d_cmd tmpl, *cmd;
+	int ret;
+
+	g2d_stat_op(ctx, img, false, img->width, img->height);
+
+	if (g2d_cpu_fill(ctx, img, img->dst.offset, img->width, img->height))
+		return 0;
+
+	if (img->width > NX_G2D_MAX_SIZE || img->height > NX_G2D_MAX_SIZE ||
+	    g2d_hybrid_size(ctx, img->width, img->height)) {
+		g2d_encode_fill(&tmpl, img);
+		if (g2d_hybrid(ctx, img, &tmpl, 0, img->dst.offset,
+			       img->width, img->height, &ret))
+			return ret;
+		return g2d_cmd_tiles(ctx, img, &tmpl, 0, img->dst.offset,
+				     img->width, img->height);
+	}
+
+	cmd = g2d_cmd_get(ctx);
+	g2d_encode_fill(cmd, img);
+
+	return g2d_cmd_commit(ctx, cmd);
+}
+
+static int
+g2d_blit(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img)
+{
+	struct nx_g2d_cmd tmpl, *cmd;
+	int ret;
+
+	g2d_stat_op(ctx, img, true, img->width, img->height);
+
+	if (img->src.type == NX_G2D_BUF_TYPE_USER) {
+		g2d_encode_blit(&tmpl, img);
+		return g2d_user_blit(ctx, img, &tmpl,
+				     img->src.offset, img->dst.offset,
+				     img->width, img->height);
+	}
+
+	if (g2d_cpu_copy(ctx, img, img->src.offset, img->dst.offset,
+			 img->width, img->height))
+		return 0;
+
+	/* large, or possibly over its own source */
+	if (img->width > NX_G2D_MAX_SIZE || img->height > NX_G2D_MAX_SIZE ||
+	    img->src.handle == img->dst.handle ||
+	    g2d_hybrid_size(ctx, img->width, img->height)) {
+		g2d_encode_blit(&tmpl, img);
+		if (g2d_hybrid(ctx, img, &tmpl, img->src.offset,
+			       img->dst.offset, img->width, img->height, &ret))
+			return ret;
+		return g2d_cmd_tiles(ctx, img, &tmpl,
+				     img->src.offset, img->dst.offset,
+				     img->width, img->height);
+	}
+
+	cmd = g2d_cmd_get(ctx);
+	g2d_encode_blit(cmd, img);
+
+	return g2d_cmd_commit(ctx, cmd);
+}
+
+drm_public
+int nexell_g2d_fillrect(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img)
+{
+	__u64 start = G2D_TRACE_TIME();
+	__u64 serial = ctx->serial;
+	int ret;
+
+	ret = g2d_fillrect(ctx, img);
+	g2d_trace_op(ctx, img, false, img->x, img->y,
+		     img->width, img->height, start, serial);
+
+	return ret;
+}
+
+drm_public int
+nexell_g2d_blit(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img)
+{
+	__u64 start = G2D_TRACE_TIME();
+	__u64 serial = ctx->serial;
+	int ret;
+
+	ret = g2d_blit(ctx, img);
+	g2d_trace_op(ctx, img, true, img->x, img->y,
+		     img->width, img->height, start, serial);
+
+	return ret;
+}
+
+drm_public
+void nexell_g2d_state_fill(struct nx_g2d_state *state,
+			   struct nx_g2d_image *img)
+{
+	state->img = *img;
+	g2d_encode_fill(&state->cmd, img);
+}
+
+drm_public
+void nexell_g2d_state_blit(struct nx_g2d_state *state,
+			   struct nx_g2d_image *img)
+{
+	state->img = *img;
+	g2d_encode_blit(&state->cmd, img);
+}
+
+drm_public
+void nexell_g2d_state_color(struct nx_g2d_state *state, unsigned int color)
+{
+	state->img.fillcolor = color;
+	state->cmd.cmd[NX_G2D_CMD_SOLID_COLOR] = color;	/* SOLID_COLOR */
+}
+
+/* one rectangle of a state, on the CPU, split or on the G2D */
+static int
+g2d_state_fill(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	       struct nx_g2d_cmd *tmpl, __u32 offset, int width, int height)
+{
+	int ret;
+
+	if (g2d_cpu_fill(ctx, img, offset, width, height))
+		return 0;
+
+	if (g2d_hybrid(ctx, img, tmpl, 0, offset, width, height, &ret))
+		return ret;
+
+	return g2d_cmd_tiles(ctx, img, tmpl, 0, offset, width, height);
+}
+
+static int
+g2d_state_blit(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+	       struct nx_g2d_cmd *tmpl, __u32 src_offset, __u32 dst_offset,
+	       int width, int height)
+{
+	int ret;
+
+	if (img->src.type == NX_G2D_BUF_TYPE_USER)
+		return g2d_user_blit(ctx, img, tmpl, src_offset, dst_offset,
+				     width, height);
+
+	if (g2d_cpu_copy(ctx, img, src_offset, dst_offset, width, height))
+		return 0;
+
+	if (g2d_hybrid(ctx, img, tmpl, src_offset, dst_offset,
+		       width, height, &ret))
+		return ret;
+
+	return g2d_cmd_tiles(ctx, img, tmpl, src_offset, dst_offset,
+			     width, height);
+}
+
+drm_public
+int nexell_g2d_state_fillrects(struct nx_g2d_ctx *ctx,
+			       struct nx_g2d_state *state,
+			       const struct nx_g2d_rect *rects, int num)
+{
+	struct nx_g2d_image *img = &state->img;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	int i, ret;
+
+	for (i = 0; i < num; i++) {
+		const struct nx_g2d_rect *r = &rects[i];
+		__u32 offset = OFFSET(dst, r->x, r->y);
+		__u64 start = G2D_TRACE_TIME();
+		__u64 serial = ctx->serial;
+
+		if (r->width <= 0 || r->height <= 0)
+			continue;
+
+		g2d_stat_op(ctx, img, false, r->width, r->height);
+
+		ret = g2d_state_fill(ctx, img, &state->cmd, offset,
+				     r->width, r->height);
+		g2d_trace_op(ctx, img, false, r->x, r->y,
+			     r->width, r->height, start, serial);
+		if (ret < 0)
+			break;
+	}
+
+	return i;
+}
+
+drm_public
+int nexell_g2d_state_blits(struct nx_g2d_ctx *ctx,
+			   struct nx_g2d_state *state,
+			   const struct nx_g2d_rect *rects,
+			   const struct nx_g2d_point *points, int num)
+{
+	struct nx_g2d_image *img = &state->img;
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	int i, ret;
+
+	for (i = 0; i < num; i++) {
+		const struct nx_g2d_rect *r = &rects[i];
+		__u32 src_offset = OFFSET(src, r->x, r->y);
+		__u32 dst_offset = OFFSET(dst, points[i].x, points[i].y);
+		__u64 start = G2D_TRACE_TIME();
+		__u64 serial = ctx->serial;
+
+		if (r->width <= 0 || r->height <= 0)
+			continue;
+
+		g2d_stat_op(ctx, img, true, r->width, r->height);
+
+		ret = g2d_state_blit(ctx, img, &state->cmd, src_offset,
+				     dst_offset, r->width, r->height);
+		g2d_trace_op(ctx, img, true, points[i].x, points[i].y,
+			     r->width, r->height, start, serial);
+		if (ret < 0)
+			break;
+	}
+
+	return i;
+}
+
+drm_public
+int nexell_g2d_fillrects(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+			 const struct nx_g2d_rect *rects, int num)
+{
+	struct nx_g2d_state state;
+
+	/* invariant registers once, per rectangle only patched */
+	nexell_g2d_state_fill(&state, img);
+
+	return nexell_g2d_state_fillrects(ctx, &state, rects, num);
+}
+
+drm_public
+int nexell_g2d_blits(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+		     const struct nx_g2d_rect *rects,
+		     const struct nx_g2d_point *points, int num)
+{
+	struct nx_g2d_state state;
+
+	nexell_g2d_state_blit(&state, img);
+
+	return nexell_g2d_state_blits(ctx, &state, rects, points, num);
+}
+
+drm_public
+int nexell_g2d_list_begin(struct nx_g2d_ctx *ctx)
+{
+	if (ctx->list)
+		return -EBUSY;
+
+	ctx->list = calloc(1, sizeof(*ctx->list));
+	if (!ctx->list)
+		return -ENOMEM;
+
+	return 0;
+}
+
+drm_public
+struct nx_g2d_list *nexell_g2d_list_end(struct nx_g2d_ctx *ctx)
+{
+	struct nx_g2d_list *list = ctx->list;
+
+	ctx->list = NULL;
+
+	if (list)
+		D_DEBUG("display list %d commands\n", list->count);
+
+	return list;
+}
+
+drm_public
+int nexell_g2d_list_replay(struct nx_g2d_ctx *ctx, struct nx_g2d_list *list,
+			   const struct nx_g2d_reloc *relocs, int num)
+{
+	struct nx_g2d_cmd *cmds = list->cmds;
+	int i, j, ret;
+
+	if (ctx->list)
+		return -EBUSY;
+
+	if (!list->count)
+		return 0;
+
+	if (num) {
+		if (!list->relocated) {
+			list->relocated = malloc(list->count * sizeof(*cmds));
+			if (!list->relocated)
+				return -ENOMEM;
+		}
+
+		/* match the recorded handles, not the relocated ones */
+		for (i = 0; i < list->count; i++) {
+			struct nx_g2d_cmd *cmd = &list->relocated[i];
+
+			*cmd = cmds[i];
+
+			for (j = 0; j < num; j++) {
+				const struct nx_g2d_reloc *r = &relocs[j];
+
+				if (cmds[i].src.handle == r->handle) {
+					cmd->src.offset += r->offset;
+					if (r->new_handle)
+						cmd->src.handle = r->new_handle;
+				}
+
+				if (cmds[i].dst.handle == r->handle) {
+					cmd->dst.offset += r->offset;
+					if (r->new_handle)
+						cmd->dst.handle = r->new_handle;
+				}
+			}
+		}
+
+		cmds = list->relocated;
+	}
+
+	/* keep the order with the commands queued before */
+	ret = g2d_batch_flush(ctx);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < list->count; i++)
+		g2d_cmd_serial(ctx, &cmds[i]);
+
+	return g2d_submit_done(ctx, cmds, list->count);
+}
+
+drm_public
+void nexell_g2d_list_free(struct nx_g2d_list *list)
+{
+	if (!list)
+		return;
+
+	free(list->relocated);
+	free(list->cmds);
+	free(list);
+}
+
+drm_public
+int nexell_g2d_sync(struct nx_g2d_ctx *ctx)
+{
+	__u64 serial = ctx->serial;
+	__u64 start = G2D_STAT_TIME();
+	__u64 trace = G2D_TRACE_TIME();
+	int ret;
+
+	ret = g2d_batch_flush(ctx);
+	if (ret < 0)
+		return ret;
+
+	G2D_MARKER_BEGIN("g2d sync ctx %d serial %llu",
+			 ctx->id, (unsigned long long)serial);
+
+	if (ctx->ring) {
+		ret = nx_g2d_ring_drain(ctx->ring);
+		if (ret < 0)
+			goto out;
+	}
+
+	ret = g2d_sync(ctx, &ctx->cmd);
+	if (ret < 0)
+		goto out;
+
+	g2d_retire(ctx, serial);
+	nx_g2d_stats_sync(ctx, start);
+	if (ctx->capture)
+		nx_g2d_capture_sync(ctx, serial);
+	G2D_TRACE(.type = NX_G2D_TRACE_SYNC, .ctx = ctx->id, .ts = trace,
+		  .serial = serial);
+
+out:
+	G2D_MARKER_END();
+
+	return ret;
+}
+
+drm_public
+__u64 nexell_g2d_serial(struct nx_g2d_ctx *ctx)
+{
+	return ctx->serial;
+}
+
+drm_public
+int nexell_g2d_wait(struct nx_g2d_ctx *ctx, __u64 serial)
+{
+	/* already retired, no need to drain the engine */
+	if (serial <= ctx->serial_done)
+		return 0;
+
+	D_DEBUG("wait serial %llu (done %llu, last %llu)\n",
+		serial, ctx->serial_done, ctx->serial);
+
+	/*
+	 * The kernel only waits for the whole queue, so waiting for
+	 * any pending serial retires everything queued so far.
+	 */
+	return nexell_g2d_sync(ctx);
 }
@@ -54,6 +54,61 @@ enum nx_g2d_pixel_format {
 	NX_G2D_PIXEL_FMT_ARGB8888 = 13,
 };
 
+enum nx_g2d_b_rop_mode {
+	GL_BLEND_ROP_CLEAR = 0,
+	GL_BLEND_ROP_NOR = 1,
+	GL_BLEND_ROP_AND_INVERTED = 2,
+	GL_BLEND_ROP_COPY_INVERTED = 3,
+	GL_BLEND_ROP_AND_REVERSE = 4,
+	GL_BLEND_ROP_NOOP = 5,
+	GL_BLEND_ROP_XOR = 6,
+	GL_BLEND_ROP_NAND = 7,
+	GL_BLEND_ROP_AND = 8,
+	GL_BLEND_ROP_EQUIV = 9,
+	GL_BLEND_ROP_INVERT = 10,
+	GL_BLEND_ROP_OR_INVERTED = 11,
+	GL_BLEND_ROP_COPY = 12,
+	GL_BLEND_ROP_OR_REVERSE = 13,
+	GL_BLEND_ROP_OR = 14,
+	GL_BLEND_ROP_SET = 15,
+};
+
+enum nx_g2d_b_dst_alpha {
+	GL_BLEND_ZERO = 0,
+	GL_BLEND_ONE = 1,
+	GL_BLEND_SRC_COLOR = 2,
+	GL_BLEND_ONE_MINUS_SRC_COLOR = 3,
+	GL_BLEND_DST_COLOR = 4,
+	GL_BLEND_ONE_MINUS_DST_COLOR = 5,
+	GL_BLEND_SRC_ALPHA = 6,
+	GL_BLEND_ONE_MINUS_SRC_ALPHA = 7,
+	GL_BLEND_DST_ALPHA = 8,
+	GL_BLEND_ONE_MINUS_DST_ALPHA = 9,
+	GL_BLEND_CONSTANT_COLOR = 10,
+	GL_BLEND_ONE_MINUS_CONSTANT_COLOR = 11,
+	GL_BLEND_CONSTANT_ALPHA = 12,
+	GL_BLEND_ONE_MINUS_CONSTANT_ALPHA = 13,
+	GL_BLEND_SRC_ALPHA_SATURATE = 14,
+};
+
+enum nx_g2d_b_equat_alpha {
+	GL_EQUATION_FUNC_ADD = 0,
+	GL_EQUATION_FUNC_SUB = 1,
+	GL_EQUATION_FUNC_REVERSE_SUB = 2,
+	GL_EQUATION_FUNC_MIN = 3,
+	GL_EQUATION_FUNC_MAX = 4,
+	GL_EQUATION_FUNC_DARKEN = 5,
+	GL_EQUATION_FUNC_LIGHTEN = 6,
+	GL_EQUATION_FUNC_MULTIPLY = 7,
+};
+
+/*
+ * Blit source in user memory, read through vaddr instead of a buffer
+ * handle. The kernel has no way to take user memory, these blits are
+ * rendered by the CPU straight into the CPU mapped destination.
+ */
+#define NX_G2D_BUF_TYPE_USER	0xff
+
 struct nx_g2d_image_obj {
 	unsigned int type;
 	unsigned int handle;
@@ -63,6 +118,26 @@ struct nx_g2d_image_obj {
 	int pixelorder;
 	int pixelformat;
 	int pixelbyte;
+	/* CPU mapping of the buffer (offset 0), NULL if not mapped */
+	void *vaddr;
+};
+
+/*
+ * Blend equation for fills and blits: GL_BLEND_* factors and
+ * GL_EQUATION_FUNC_*, the source of a fill is the fill color.
+ * force_alpha replaces the source alpha with 'alpha'.
+ * rop_enable applies the GL_BLEND_ROP_* 'rop' instead of the equation.
+ * The destination is read when a factor or the rop needs it.
+ */
+struct nx_g2d_blend {
+	int enable;
+	int src_rgb, dst_rgb;
+	int src_alpha, dst_alpha;
+	int equat_rgb, equat_alpha;
+	int force_alpha;
+	int alpha;
+	int rop_enable;
+	int rop;
 };
 
 struct nx_g2d_image {
@@ -71,6 +146,7 @@ struct nx_g2d_image {
 
 	struct nx_g2d_image_obj src;
 	struct nx_g2d_image_obj dst;
+	struct nx_g2d_blend blend;
 
 	unsigned int fillcolor;
 	unsigned int blendcolor;
@@ -78,8 +154,17 @@ struct nx_g2d_image {
 	void *data;
 };
 
+struct nx_g2d_rect {
+	int x, y;
+	int width, height;
+};
+
+struct nx_g2d_point {
+	int x, y;
+};
+
 #define BIT(n)		(1UL << (n))
-#define BITS(v, n, s)	((v & ((1 << n) - 1)) << (s))
+#define BITS(v, n, s)	((((unsigned int)(v)) & ((1U << (n)) - 1)) << (s))
 
 #define RGBA_COLOR(r, g, b, a) \
 	(((r & 0xff) << 24) | \
@@ -87,15 +172,256 @@ struct nx_g2d_image {
 	 ((b & 0xff) << 8) | \
 	  (a & 0xff))
 
+struct nx_g2d_dev;
 struct nx_g2d_ctx;
 
+/*
+ * NX_G2D_ALLOC_SOFTWARE runs the command stream on the CPU instead of the
+ * G2D, nexell_g2d_alloc() selects it with NEXELL_G2D_BACKEND=sw.
+ */
+#define NX_G2D_ALLOC_SOFTWARE	BIT(0)
+
+/*
+ * A device is shared, contexts are not: every thread creates its own
+ * context on the device and gets its own commands, batch and completion
+ * tracking, without locking against the other contexts. A context keeps
+ * the device open until nexell_g2d_free(). Buffers shared by contexts
+ * are synchronized by the callers, e.g. with nexell_g2d_wait().
+ */
+struct nx_g2d_dev *nexell_g2d_dev_open(int fd, unsigned int flags,
+				       int *major, int *minor);
+void nexell_g2d_dev_close(struct nx_g2d_dev *dev);
+struct nx_g2d_ctx *nexell_g2d_ctx_create(struct nx_g2d_dev *dev);
+struct nx_g2d_dev *nexell_g2d_get_dev(struct nx_g2d_ctx *ctx);
+
+/* device and context in one, the context owns the device */
 struct nx_g2d_ctx *nexell_g2d_alloc(int fd, int *major, int *minor);
+struct nx_g2d_ctx *nexell_g2d_alloc_flags(int fd, unsigned int flags,
+					  int *major, int *minor);
 void nexell_g2d_free(struct nx_g2d_ctx *ctx);
 
+/*
+ * Buffer handle of a dma-buf fd, from a camera, a decoder or another
+ * process. Imports are cached by buffer, a buffer passed again with any
+ * fd returns the same handle, without an import since Linux 5.3. Every
+ * import holds the handle until nexell_g2d_import_put(), hold it while
+ * queuing commands with it. Once put, it is only closed when no command
+ * queued by any context uses it. At most 16 buffers can be held, -EBUSY
+ * beyond. 'owned' is a handle the caller already has on the same DRM fd
+ * for the buffer, 0 if none: an import returning it is left to the
+ * caller. The software engine needs Linux 5.3, -ENOTSUP before.
+ */
+int nexell_g2d_import(struct nx_g2d_ctx *ctx, int fd, unsigned int owned,
+		      unsigned int *handle);
+void nexell_g2d_import_put(struct nx_g2d_ctx *ctx, unsigned int handle);
+
+/*
+ * CPU mapping of a buffer handle, required by the software engine
+ * for every handle it renders from or to. No-op for the hardware.
+ * A binding is kept until nexell_g2d_unbind(), binding more than 64
+ * handles fails with -ENOSPC.
+ */
+int nexell_g2d_bind(struct nx_g2d_ctx *ctx, unsigned int handle,
+		    void *addr, unsigned long size);
+void nexell_g2d_unbind(struct nx_g2d_ctx *ctx, unsigned int handle);
+
 int nexell_g2d_fillrect(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img);
 
 int nexell_g2d_blit(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img);
 
+/*
+ * Array variants: the registers of img are encoded once and only the
+ * rectangle is patched per entry. Rectangles and points are in pixels
+ * relative to the image object offsets. Return the number of entries
+ * done, less than num on failure.
+ */
+int nexell_g2d_fillrects(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+			 const struct nx_g2d_rect *rects, int num);
+int nexell_g2d_blits(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img,
+		     const struct nx_g2d_rect *rects,
+		     const struct nx_g2d_point *points, int num);
+
+/*
+ * Submission thread: submitted commands are pushed into a lock-free ring
+ * of 'size' entries and a thread runs them on the G2D, so the caller
+ * never blocks in the kernel. nexell_g2d_sync() waits for the ring to
+ * drain before waiting for the engine. size 0 takes the NEXELL_G2D_RING
+ * environment, where unset or 0 keeps submitting from the caller and
+ * 1 selects the default ring size.
+ */
+int nexell_g2d_ring_begin(struct nx_g2d_ctx *ctx, int size);
+int nexell_g2d_ring_end(struct nx_g2d_ctx *ctx);
+
+/*
+ * Hybrid execution: fills and same format copies of at least
+ * NEXELL_G2D_HYBRID_PIXELS (default 65536) pixels on idle, CPU mapped
+ * buffers are split into rows done by the G2D and bands done by 'threads'
+ * CPU workers, returning when the workers are done. The G2D rows are
+ * waited for as any other queued command. The G2D share adapts to the
+ * throughput measured on each side. threads 0 takes the
+ * NEXELL_G2D_HYBRID environment, where unset or 0 keeps the G2D only.
+ */
+int nexell_g2d_hybrid_begin(struct nx_g2d_ctx *ctx, int threads);
+void nexell_g2d_hybrid_end(struct nx_g2d_ctx *ctx);
+
+/*
+ * Pre-encoded command of an image setup. nexell_g2d_state_fill() and
+ * nexell_g2d_state_blit() encode the registers that don't change per
+ * operation once, the operations then only patch the buffer offsets,
+ * SIZE and the line sizes. nexell_g2d_state_color() replaces the fill
+ * color without encoding again. Rectangles and points are relative to
+ * the image object offsets, as for nexell_g2d_fillrects().
+ */
+struct nx_g2d_state {
+	struct nx_g2d_image img;
+	struct nx_g2d_cmd cmd;
+};
+
+void nexell_g2d_state_fill(struct nx_g2d_state *state,
+			   struct nx_g2d_image *img);
+void nexell_g2d_state_blit(struct nx_g2d_state *state,
+			   struct nx_g2d_image *img);
+void nexell_g2d_state_color(struct nx_g2d_state *state, unsigned int color);
+int nexell_g2d_state_fillrects(struct nx_g2d_ctx *ctx,
+			       struct nx_g2d_state *state,
+			       const struct nx_g2d_rect *rects, int num);
+int nexell_g2d_state_blits(struct nx_g2d_ctx *ctx,
+			   struct nx_g2d_state *state,
+			   const struct nx_g2d_rect *rects,
+			   const struct nx_g2d_point *points, int num);
+
+/*
+ * Display list: between nexell_g2d_list_begin() and nexell_g2d_list_end()
+ * the fully encoded commands of every operation are recorded instead of
+ * being run, the CPU paths are not used while recording.
+ * nexell_g2d_list_replay() queues the recorded commands again without any
+ * encoding, as one submission. Each relocation adds 'offset' to the
+ * buffer offsets of the recorded 'handle' and replaces the handle with
+ * 'new_handle' when not 0.
+ */
+struct nx_g2d_list;
+
+struct nx_g2d_reloc {
+	unsigned int handle;
+	unsigned int new_handle;
+	int offset;
+};
+
+int nexell_g2d_list_begin(struct nx_g2d_ctx *ctx);
+struct nx_g2d_list *nexell_g2d_list_end(struct nx_g2d_ctx *ctx);
+int nexell_g2d_list_replay(struct nx_g2d_ctx *ctx, struct nx_g2d_list *list,
+			   const struct nx_g2d_reloc *relocs, int num);
+void nexell_g2d_list_free(struct nx_g2d_list *list);
+
 int nexell_g2d_sync(struct nx_g2d_ctx *ctx);
 
+/*
+ * Fills and same format copies up to 'pixels' in size are done with the
+ * CPU kernels when the buffers are mapped (vaddr) and no G2D command
+ * using them is pending. 0 disables, the default is taken from the
+ * NEXELL_G2D_CPU_THRESHOLD environment.
+ */
+void nexell_g2d_set_cpu_threshold(struct nx_g2d_ctx *ctx, int pixels);
+
+/*
+ * Dispatch threshold calibration: times fills and copies of several sizes
+ * and formats on the CPU and on the G2D with scratch buffers, and sets the
+ * largest sizes the CPU kernels take. The thresholds are stored in the
+ * cache file 'path' with the backend (G2D or software engine) and the
+ * driver version, and loaded from it on later calls with the same
+ * backend and version instead of measuring again.
+ * path NULL takes the NEXELL_G2D_CALIBRATE environment. An unset, empty
+ * or "0" path skips calibration and "1" selects the default cache file.
+ * Returns 0 with the thresholds in 'calib', 1 if skipped.
+ */
+struct nx_g2d_calib {
+	int fill;		/* CPU fill threshold in pixels */
+	int copy;		/* CPU copy threshold in pixels */
+	int cached;		/* loaded from the cache file */
+};
+
+int nexell_g2d_calibrate(struct nx_g2d_ctx *ctx, const char *path,
+			 struct nx_g2d_calib *calib);
+
+/*
+ * Context statistics, counted when built with NX_G2D_STATS (configure
+ * --disable-stats compiles them out). The latency histograms count
+ * periods of [2^(n-1), 2^n) microseconds in bucket n, bucket 0 below
+ * 1 us and the last bucket everything longer.
+ *	submit_lat : first command submitted to the engine being idle
+ *	sync_lat   : nexell_g2d_sync() calls
+ * When the NEXELL_G2D_STATS environment names a file, the statistics
+ * are written to it every NEXELL_G2D_STATS_INTERVAL ms (1000), and the
+ * context number is appended to the name for contexts after the first.
+ * nexell_g2d_get_stats() returns -ENOSYS when compiled out.
+ */
+#define NX_G2D_STATS_BUCKETS	24
+
+struct nx_g2d_stats {
+	__u64 fills;			/* fill rectangles */
+	__u64 blits;			/* blit rectangles */
+	__u64 pixels;			/* pixels written */
+	__u64 bytes;			/* bytes read and written */
+	__u64 cpu_ops;			/* done by the CPU kernels */
+	__u64 hybrid_ops;		/* split with the CPU workers */
+	__u64 user_blits;		/* from user memory */
+	__u64 commands;			/* G2D commands run */
+	__u64 ioctls;			/* exec, list and sync ioctls */
+	__u64 syncs;			/* nexell_g2d_sync() calls */
+	__u64 fallbacks;		/* states rejected by the driver */
+	__u64 overlap_tiles;		/* commands of copies over their source */
+	__u64 submit_lat[NX_G2D_STATS_BUCKETS];
+	__u64 sync_lat[NX_G2D_STATS_BUCKETS];
+};
+
+int nexell_g2d_get_stats(struct nx_g2d_ctx *ctx, struct nx_g2d_stats *stats);
+void nexell_g2d_stats_fallback(struct nx_g2d_ctx *ctx);
+
+/*
+ * Operation trace: with NEXELL_G2D_TRACE set, every fill and blit
+ * rectangle, submission and sync is recorded to a ring of the calling
+ * thread, keeping the last NEXELL_G2D_TRACE records (4096 when "1").
+ * The records are binary, nexell_g2d_trace_dump() formats the records
+ * of all threads to 'path' and is also run at exit when
+ * NEXELL_G2D_TRACE_FILE names a file.
+ * nexell_g2d_trace_export() writes them as a Chrome/Perfetto JSON
+ * timeline, with flows from each operation to its submission and from
+ * each submission to the sync retiring it, also at exit when
+ * NEXELL_G2D_TRACE_JSON names a file.
+ *
+ * NEXELL_G2D_TRACE_MARKER=1 writes begin/end markers of the submissions
+ * and syncs to the kernel trace_marker, to correlate them with the DRM
+ * events, or to /tmp/nexell_g2d.marker without tracefs. Any other value
+ * is the file to write the markers to.
+ */
+int nexell_g2d_trace_dump(const char *path);
+int nexell_g2d_trace_export(const char *path);
+
+/*
+ * Every queued command gets an increasing serial number.
+ * nexell_g2d_serial() returns the serial of the last queued command and
+ * nexell_g2d_wait() returns once that serial has been completed,
+ * without touching the engine when it has already retired.
+ */
+__u64 nexell_g2d_serial(struct nx_g2d_ctx *ctx);
+int nexell_g2d_wait(struct nx_g2d_ctx *ctx, __u64 serial);
+
+/*
+ * Command batch: operations are queued in the context and submitted
+ * when the batch is full, on nexell_g2d_sync() or nexell_g2d_batch_flush().
+ * size 0 takes the NEXELL_G2D_BATCH environment or the default size,
+ * a resulting size of 0 or 1 keeps every operation submitted immediately.
+ * A batch is submitted with one ioctl only when the kernel provides
+ * DRM_IOCTL_NX_G2D_DMA_EXEC_LIST, otherwise with one per command, and
+ * only defers the G2D. nexell_g2d_batch_probe() returns 1 when the list
+ * ioctl is built in and accepted by the kernel, 0 otherwise.
+ */
+#define NX_G2D_BATCH_SEQUENTIAL	BIT(0)	/* one ioctl per queued command */
+
+int nexell_g2d_batch_begin(struct nx_g2d_ctx *ctx, int size,
+			   unsigned int flags);
+int nexell_g2d_batch_flush(struct nx_g2d_ctx *ctx);
+int nexell_g2d_batch_end(struct nx_g2d_ctx *ctx);
+int nexell_g2d_batch_probe(struct nx_g2d_ctx *ctx);
+
 #endif /* _NXP3220_G2D_H_ */
@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Fill and blit throughput of the library over the gfxdriver formats,
+ * from 8x8 to full HD rectangles, on the G2D or on the software engine.
+ * The context is set up as the gfxdriver does it (batch, ring and hybrid
+ * from the environment), small operations may run on the CPU kernels
+ * unless -g.
+ *
+ *	nexell_g2d_bench [-b drm|sw] [-d device] [-t ms] [-g] [-j] [-o file]
+ *
+ * Each case runs for half the time as queued operations synced every
+ * BENCH_QUEUE for ops/s and Mpixels/s, and for the other half as single
+ * operations synced each for the p50/p99 latency.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+#include "nexell_g2d_formats.h"
+
+#define BENCH_DEVICE	"/dev/dri/card0"
+#define BENCH_WIDTH	1920
+#define BENCH_HEIGHT	1080
+#define BENCH_TIME	100	/* ms per case */
+#define BENCH_QUEUE	16	/* operations between syncs */
+#define BENCH_SAMPLES	1024	/* latency samples per case */
+
+/* handles of the software engine buffers */
+#define BENCH_HANDLE	0xbe0c0000
+
+/* NXG2DSupportPixelFormats of the gfxdriver */
+#define BENCH_INDEX(name, format, order, pixelbyte, caps)	BENCH_##name,
+#define BENCH_FORMAT(name, format, order, pixelbyte, caps) \
+	{ #name, format, order, pixelbyte },
+
+enum { NXG2D_FORMATS(BENCH_INDEX) };
+
+static const struct {
+	const char *name;
+	int format, order, pixelbyte;
+} bench_formats[] = {
+	NXG2D_FORMATS(BENCH_FORMAT)
+};
+
+#define BENCH_FORMATS	(int)(sizeof(bench_formats) / sizeof(bench_formats[0]))
+
+static const struct {
+	int width, height;
+} bench_sizes[] = {
+	{ 8, 8 }, { 16, 16 }, { 32, 32 }, { 64, 64 }, { 128, 128 },
+	{ 256, 256 }, { 512, 512 }, { 1280, 720 }, { 1920, 1080 },
+};
+
+#define BENCH_SIZES	(int)(sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+enum {
+	BENCH_FILL,
+	BENCH_COPY,
+	BENCH_BLEND,
+	BENCH_CONVERT,		/* from ARGB, or RGB16 to ARGB */
+	BENCH_OPS,
+};
+
+static const char * const bench_ops[] = {
+	"fill", "copy", "blend", "convert",
+};
+
+struct bench_buf {
+	unsigned int handle;
+	void *vaddr;
+	unsigned long size;
+};
+
+struct bench {
+	struct nx_g2d_ctx *ctx;
+	int fd;
+	bool sw;
+	int time_ms;
+
+	/* destination, source and converted source */
+	struct bench_buf bufs[3];
+
+	__u64 samples[BENCH_SAMPLES];
+};
+
+struct bench_result {
+	__u64 ops;
+	double ops_s, mpixels_s;
+	double p50_us, p99_us;
+};
+
+static int
+bench_buf_alloc(struct bench *b, struct bench_buf *buf, int index)
+{
+	struct drm_mode_create_dumb create = { 0 };
+	struct drm_mode_map_dumb map = { 0 };
+	int ret;
+
+	if (b->sw) {
+		buf->size = BENCH_WIDTH * BENCH_HEIGHT * 4;
+		buf->handle = BENCH_HANDLE + index;
+		buf->vaddr = calloc(1, buf->size);
+		if (!buf->vaddr)
+			return -ENOMEM;
+
+		return nexell_g2d_bind(b->ctx, buf->handle, buf->vaddr,
+				       buf->size);
+	}
+
+	create.width = BENCH_WIDTH;
+	create.height = BENCH_HEIGHT;
+	create.bpp = 32;
+
+	ret = drmIoctl(b->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
+	if (ret < 0) {
+		fprintf(stderr, "cannot allocate a %dx%d buffer\n",
+			BENCH_WIDTH, BENCH_HEIGHT);
+		return ret;
+	}
+	buf->handle = create.handle;
+
+	map.handle = create.handle;
+	ret = drmIoctl(b->fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
+	if (ret < 0)
+		return ret;
+
+	buf->vaddr = mmap(NULL, create.size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, b->fd, map.offset);
+	if (buf->vaddr == MAP_FAILED) {
+		buf->vaddr = NULL;
+		return -errno;
+	}
+	buf->size = create.size;
+
+	return 0;
+}
+
+static void
+bench_buf_free(struct bench *b, struct bench_buf *buf)
+{
+	struct drm_mode_destroy_dumb destroy = { 0 };
+
+	if (b->sw) {
+		nexell_g2d_unbind(b->ctx, buf->handle);
+		free(buf->vaddr);
+		return;
+	}
+
+	if (buf->vaddr)
+		munmap(buf->vaddr, buf->size);
+
+	if (buf->handle) {
+		destroy.handle = buf->handle;
+		drmIoctl(b->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+	}
+}
+
+static void
+bench_obj(struct nx_g2d_image_obj *obj, const struct bench_buf *buf,
+	  int format, int width)
+{
+	memset(obj, 0, sizeof(*obj));
+
+	obj->handle = buf->handle;
+	obj->pixelformat = bench_formats[format].format;
+	obj->pixelorder = bench_formats[format].order;
+	obj->pixelbyte = bench_formats[format].pixelbyte;
+	obj->pitch = width * obj->pixelbyte;
+	obj->vaddr = buf->vaddr;
+}
+
+/* image of an operation on a format, NULL source for the fills */
+static void
+bench_image(struct bench *b, struct nx_g2d_image *img, int op, int format,
+	    int width, int height)
+{
+	memset(img, 0, sizeof(*img));
+
+	img->width = width;
+	img->height = height;
+	img->fillcolor = 0x80402010;
+
+	bench_obj(&img->dst, &b->bufs[0], format, BENCH_WIDTH);
+
+	if (op == BENCH_FILL)
+		return;
+
+	if (op == BENCH_CONVERT)
+		bench_obj(&img->src, &b->bufs[2],
+			  format == BENCH_ARGB ? BENCH_RGB16 : BENCH_ARGB, BENCH_WIDTH);
+	else
+		bench_obj(&img->src, &b->bufs[1], format, BENCH_WIDTH);
+
+	if (op == BENCH_BLEND) {
+		/* source over */
+		img->blend.enable = 1;
+		img->blend.src_rgb = GL_BLEND_SRC_ALPHA;
+		img->blend.dst_rgb = GL_BLEND_ONE_MINUS_SRC_ALPHA;
+		img->blend.src_alpha = GL_BLEND_ONE;
+		img->blend.dst_alpha = GL_BLEND_ONE_MINUS_SRC_ALPHA;
+		img->blend.equat_rgb = GL_EQUATION_FUNC_ADD;
+		img->blend.equat_alpha = GL_EQUATION_FUNC_ADD;
+	}
+}
+
+static inline int
+bench_op(struct bench *b, int op, struct nx_g2d_image *img)
+{
+	return op == BENCH_FILL ? nexell_g2d_fillrect(b->ctx, img) :
+				  nexell_g2d_blit(b->ctx, img);
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int
+bench_case(struct bench *b, int op, int format, int width, int height,
+	   struct bench_result *res)
+{
+	struct nx_g2d_image img;
+	__u64 budget = (__u64)b->time_ms * 1000000 / 2;
+	__u64 start, now, ops = 0;
+	int i, n = 0, ret;
+
+	bench_image(b, &img, op, format, width, height);
+
+	/* throughput, at least one queue */
+	start = nx_g2d_time_ns();
+	do {
+		for (i = 0; i < BENCH_QUEUE; i++) {
+			ret = bench_op(b, op, &img);
+			if (ret < 0)
+				return ret;
+		}
+		ret = nexell_g2d_sync(b->ctx);
+		if (ret < 0)
+			return ret;
+
+		ops += BENCH_QUEUE;
+		now = nx_g2d_time_ns();
+	} while (now - start < budget);
+
+	res->ops = ops;
+	res->ops_s = ops * 1e9 / (now - start);
+	res->mpixels_s = res->ops_s * width * height / 1e6;
+
+	/* latency, at least one sample */
+	start = nx_g2d_time_ns();
+	do {
+		__u64 t = nx_g2d_time_ns();
+
+		ret = bench_op(b, op, &img);
+		if (ret >= 0)
+			ret = nexell_g2d_sync(b->ctx);
+		if (ret < 0)
+			return ret;
+
+		now = nx_g2d_time_ns();
+		b->samples[n++] = now - t;
+	} while (n < BENCH_SAMPLES && now - start < budget);
+
+	qsort(b->samples, n, sizeof(b->samples[0]), bench_cmp);
+	res->p50_us = b->samples[n / 2] / 1e3;
+	res->p99_us = b->samples[n * 99 / 100] / 1e3;
+
+	return 0;
+}
+
+static void
+bench_print(FILE *fp, bool json, bool first, const char *backend, int op,
+	    int format, int width, int height, const struct bench_result *res)
+{
+	if (!json) {
+		fprintf(fp, "%s,%s,%s,%d,%d,%llu,%.1f,%.2f,%.1f,%.1f\n",
+			backend, bench_ops[op], bench_formats[format].name,
+			width, height, (unsigned long long)res->ops,
+			res->ops_s, res->mpixels_s, res->p50_us, res->p99_us);
+		return;
+	}
+
+	fprintf(fp, "%s\n    { \"op\": \"%s\", \"format\": \"%s\", "
+		"\"width\": %d, \"height\": %d, \"ops\": %llu, "
+		"\"ops_per_s\": %.1f, \"mpixels_per_s\": %.2f, "
+		"\"p50_us\": %.1f, \"p99_us\": %.1f }",
+		first ? "" : ",", bench_ops[op], bench_formats[format].name,
+		width, height, (unsigned long long)res->ops,
+		res->ops_s, res->mpixels_s, res->p50_us, res->p99_us);
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-b drm|sw] [-d device] [-t ms] [-g] [-j] "
+		"[-o file]\n"
+		"  -b  drm: the G2D (default), sw: the software engine\n"
+		"  -d  DRM device, default %s\n"
+		"  -t  time per case in ms, default %d\n"
+		"  -g  no operations on the CPU kernels\n"
+		"  -j  JSON instead of CSV\n"
+		"  -o  output file, default stdout\n",
+		name, BENCH_DEVICE, BENCH_TIME);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench *b;
+	struct bench_result res;
+	const char *device = BENCH_DEVICE, *backend = "drm", *out = NULL;
+	bool json = false, g2d_only = false, first = true;
+	int op, format, size, opt, i, ret = -EINVAL;
+	FILE *fp = stdout;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return 1;
+
+	b->fd = -1;
+	b->time_ms = BENCH_TIME;
+
+	while ((opt = getopt(argc, argv, "b:d:t:gjo:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			backend = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			b->time_ms = atoi(optarg);
+			break;
+		case 'g':
+			g2d_only = true;
+			break;
+		case 'j':
+			json = true;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			free(b);
+			return opt != 'h';
+		}
+	}
+
+	if (strcmp(backend, "drm") && strcmp(backend, "sw")) {
+		usage(argv[0]);
+		goto out;
+	}
+	b->sw = !strcmp(backend, "sw");
+
+	if (!b->sw) {
+		b->fd = open(device, O_RDWR | O_CLOEXEC);
+		if (b->fd < 0) {
+			fprintf(stderr, "cannot open %s: %s\n", device,
+				strerror(errno));
+			goto out;
+		}
+	}
+
+	b->ctx = nexell_g2d_alloc_flags(b->fd,
+			b->sw ? NX_G2D_ALLOC_SOFTWARE : 0, NULL, NULL);
+	if (!b->ctx) {
+		fprintf(stderr, "cannot create the G2D context\n");
+		goto out;
+	}
+
+	/* as the gfxdriver opens it */
+	nexell_g2d_batch_begin(b->ctx, 0, 0);
+	nexell_g2d_ring_begin(b->ctx, 0);
+	nexell_g2d_hybrid_begin(b->ctx, 0);
+	if (g2d_only)
+		nexell_g2d_set_cpu_threshold(b->ctx, 0);
+
+	for (i = 0; i < 3; i++) {
+		ret = bench_buf_alloc(b, &b->bufs[i], i);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (out) {
+		fp = fopen(out, "w");
+		if (!fp) {
+			ret = -errno;
+			fprintf(stderr, "cannot create %s\n", out);
+			fp = stdout;
+			goto out;
+		}
+	}
+
+	if (json)
+		fprintf(fp, "{\n  \"backend\": \"%s\",\n  \"results\": [",
+			backend);
+	else
+		fprintf(fp, "backend,op,format,width,height,ops,ops_per_s,"
+			"mpixels_per_s,p50_us,p99_us\n");
+
+	for (op = 0; op < BENCH_OPS; op++) {
+		for (format = 0; format < BENCH_FORMATS; format++) {
+			for (size = 0; size < BENCH_SIZES; size++) {
+				int w = bench_sizes[size].width;
+				int h = bench_sizes[size].height;
+
+				ret = bench_case(b, op, format, w, h, &res);
+				if (ret < 0) {
+					fprintf(stderr, "%s %s %dx%d failed: %d\n",
+						bench_ops[op],
+						bench_formats[format].name,
+						w, h, ret);
+					goto out;
+				}
+
+				bench_print(fp, json, first, backend, op,
+					    format, w, h, &res);
+				first = false;
+			}
+		}
+	}
+
+	if (json)
+		fprintf(fp, "\n  ]\n}\n");
+
+out:
+	if (fp != stdout)
+		fclose(fp);
+
+	if (b->ctx) {
+		for (i = 0; i < 3; i++)
+			bench_buf_free(b, &b->bufs[i]);
+		nexell_g2d_free(b->ctx);
+	}
+
+	if (b->fd >= 0)
+		close(b->fd);
+	free(b);
+
+	return ret < 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * Dispatch threshold calibration
+ *
+ * Squares of CALIB_MIN to CALIB_SIZE pixels are filled and copied
+ * CALIB_LOOPS times with the CPU kernels and with queued G2D commands.
+ * The threshold of a format is the largest square still faster on the
+ * CPU, below the first one faster on the G2D, and the smallest threshold
+ * of all formats is taken.
+ */
+
+#define NX_G2D_CALIB_FILE	"/var/cache/nexell_g2d.calib"
+
+#define CALIB_MIN	8
+#define CALIB_SIZE	256	/* scratch buffer width and height */
+#define CALIB_LOOPS	16
+
+/* handles of the software engine scratch buffers */
+#define CALIB_HANDLE	0xca1b0000
+
+struct calib_buf {
+	unsigned int handle;
+	void *vaddr;
+	unsigned long size;
+	int pitch;
+};
+
+static const struct {
+	int format;
+	int pixelbyte;
+} calib_formats[] = {
+	{ NX_G2D_PIXEL_FMT_ARGB8888, 4 },
+	{ NX_G2D_PIXEL_FMT_RGB565, 2 },
+};
+
+#define CALIB_FORMATS	(int)(sizeof(calib_formats) / sizeof(calib_formats[0]))
+
+static int
+calib_buf_alloc(struct nx_g2d_ctx *ctx, struct calib_buf *buf, int index)
+{
+	struct nx_g2d_dev *dev = ctx->dev;
+	struct drm_mode_create_dumb create = { 0 };
+	struct drm_mode_map_dumb map = { 0 };
+	struct drm_mode_destroy_dumb destroy = { 0 };
+	int ret;
+
+	if (dev->sw) {
+		buf->pitch = CALIB_SIZE * 4;
+		buf->size = buf->pitch * CALIB_SIZE;
+		buf->handle = CALIB_HANDLE + index;
+		buf->vaddr = calloc(1, buf->size);
+		if (!buf->vaddr)
+			return -ENOMEM;
+
+		ret = nexell_g2d_bind(ctx, buf->handle, buf->vaddr, buf->size);
+		if (ret < 0) {
+			free(buf->vaddr);
+			buf->vaddr = NULL;
+		}
+		return ret;
+	}
+
+	create.width = CALIB_SIZE;
+	create.height = CALIB_SIZE;
+	create.bpp = 32;
+
+	ret = drmIoctl(dev->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
+	if (ret < 0) {
+		D_ERROR("%s() Failed DRM_IOCTL_MODE_CREATE_DUMB\n", __func__);
+		return ret;
+	}
+
+	map.handle = create.handle;
+	ret = drmIoctl(dev->fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
+	if (ret < 0) {
+		D_ERROR("%s() Failed DRM_IOCTL_MODE_MAP_DUMB\n", __func__);
+		goto err;
+	}
+
+	buf->vaddr = mmap(NULL, create.size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, dev->fd, map.offset);
+	if (buf->vaddr == MAP_FAILED) {
+		D_ERROR("%s() Failed to map the scratch buffer\n", __func__);
+		buf->vaddr = NULL;
+		ret = -errno;
+		goto err;
+	}
+
+	buf->handle = create.handle;
+	buf->pitch = create.pitch;
+	buf->size = create.size;
+
+	return 0;
+
+err:
+	destroy.handle = create.handle;
+	drmIoctl(dev->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+
+	return ret;
+}
+
+static void
+calib_buf_free(struct nx_g2d_ctx *ctx, struct calib_buf *buf)
+{
+	struct nx_g2d_dev *dev = ctx->dev;
+	struct drm_mode_destroy_dumb destroy = { 0 };
+
+	if (!buf->vaddr)
+		return;
+
+	if (dev->sw) {
+		nexell_g2d_unbind(ctx, buf->handle);
+		free(buf->vaddr);
+		return;
+	}
+
+	munmap(buf->vaddr, buf->size);
+
+	destroy.handle = buf->handle;
+	drmIoctl(dev->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+}
+
+/* ns per operation, < 0 if a G2D command failed */
+static long long
+calib_time(struct nx_g2d_ctx *ctx, struct nx_g2d_image *img, bool blit,
+	   bool cpu)
+{
+	struct nx_g2d_image_obj *src = &img->src;
+	struct nx_g2d_image_obj *dst = &img->dst;
+	unsigned int pixel = nx_g2d_sw_color(dst->pixelformat, dst->pixelorder,
+					     img->fillcolor);
+	__u64 start;
+	int i, ret = 0;
+
+	start = nx_g2d_time_ns();
+
+	for (i = 0; i < CALIB_LOOPS && !ret; i++) {
+		if (cpu && blit)
+			nx_g2d_cpu_copy(dst->vaddr, dst->pitch,
+					src->vaddr, src->pitch,
+					img->width * dst->pixelbyte,
+					img->height);
+		else if (cpu)
+			nx_g2d_cpu_fill(dst->vaddr, dst->pitch,
+					img->width, img->height,
+					dst->pixelbyte, pixel);
+		else if (blit)
+			ret = nexell_g2d_blit(ctx, img);
+		else
+			ret = nexell_g2d_fillrect(ctx, img);
+	}
+
+	if (!cpu && !ret)
+		ret = nexell_g2d_sync(ctx);
+
+	if (ret < 0)
+		return ret;
+
+	return (nx_g2d_time_ns() - start) / CALIB_LOOPS;
+}
+
+/* largest size in pixels faster on the CPU, < 0 on G2D failure */
+static int
+calib_threshold(struct nx_g2d_ctx *ctx, struct calib_buf *bufs, int format,
+		bool blit)
+{
+	struct nx_g2d_image img = { 0 };
+	long long cpu, g2d;
+	int size, threshold = 0;
+
+	img.fillcolor = 0xff204080;
+	img.dst.type = NX_G2D_BUF_TYPE_GEM;
+	img.dst.handle = bufs[0].handle;
+	img.dst.pitch = bufs[0].pitch;
+	img.dst.pixelorder = NX_G2D_PIXEL_ORDER_ARGB;
+	img.dst.pixelformat = calib_formats[format].format;
+	img.dst.pixelbyte = calib_formats[format].pixelbyte;
+	img.dst.vaddr = bufs[0].vaddr;
+
+	img.src = img.dst;
+	img.src.handle = bufs[1].handle;
+	img.src.pitch = bufs[1].pitch;
+	img.src.vaddr = bufs[1].vaddr;
+
+	for (size = CALIB_MIN; size <= CALIB_SIZE; size *= 2) {
+		img.width = size;
+		img.height = size;
+
+		/* first run maps the pages and warms the caches */
+		g2d = calib_time(ctx, &img, blit, false);
+		if (g2d >= 0)
+			g2d = calib_time(ctx, &img, blit, false);
+		if (g2d < 0)
+			return g2d;
+
+		cpu = calib_time(ctx, &img, blit, true);
+
+		D_DEBUG("calibrate %s %dbpp %dx%d: cpu %lld ns, g2d %lld ns\n",
+			blit ? "copy" : "fill", img.dst.pixelbyte * 8,
+			size, size, cpu, g2d);
+
+		if (g2d < cpu)
+			break;
+
+		threshold = size * size;
+	}
+
+	return threshold;
+}
+
+static int
+calib_measure(struct nx_g2d_ctx *ctx, struct nx_g2d_calib *calib)
+{
+	struct calib_buf bufs[2] = { { 0 } };
+	struct nx_g2d_pool *pool = ctx->pool;
+	int fill = ctx->cpu_fill_threshold;
+	int copy = ctx->cpu_copy_threshold;
+	int i, ret;
+
+	for (i = 0; i < 2; i++) {
+		ret = calib_buf_alloc(ctx, &bufs[i], i);
+		if (ret < 0)
+			goto out;
+	}
+
+	/* every timed operation on the G2D only */
+	nexell_g2d_set_cpu_threshold(ctx, 0);
+	ctx->pool = NULL;
+
+	calib->fill = CALIB_SIZE * CALIB_SIZE;
+	calib->copy = CALIB_SIZE * CALIB_SIZE;
+
+	for (i = 0; i < CALIB_FORMATS; i++) {
+		ret = calib_threshold(ctx, bufs, i, false);
+		if (ret < 0)
+			break;
+		if (ret < calib->fill)
+			calib->fill = ret;
+
+		ret = calib_threshold(ctx, bufs, i, true);
+		if (ret < 0)
+			break;
+		if (ret < calib->copy)
+			calib->copy = ret;
+	}
+
+	ctx->pool = pool;
+	ctx->cpu_fill_threshold = fill;
+	ctx->cpu_copy_threshold = copy;
+
+out:
+	for (i = 0; i < 2; i++)
+		calib_buf_free(ctx, &bufs[i]);
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * The cache is keyed by the backend and the driver version, the software
+ * engine reports the same version as the G2D and must not share numbers
+ */
+static inline const char *
+calib_backend(struct nx_g2d_ctx *ctx)
+{
+	return ctx->dev->sw ? "sw" : "g2d";
+}
+
+static int
+calib_load(struct nx_g2d_ctx *ctx, const char *path,
+	   struct nx_g2d_calib *calib)
+{
+	char backend[8];
+	FILE *fp;
+	int major, minor, n;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	n = fscanf(fp, "%7s %d.%d %d %d", backend, &major, &minor,
+		   &calib->fill, &calib->copy);
+	fclose(fp);
+
+	if (n != 5 || strcmp(backend, calib_backend(ctx)) ||
+	    major != ctx->dev->major || minor != ctx->dev->minor) {
+		D_DEBUG("calibration cache %s is stale\n", path);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* written to a temporary file first, a torn cache is never loaded */
+static void
+calib_save(struct nx_g2d_ctx *ctx, const char *path,
+	   struct nx_g2d_calib *calib)
+{
+	char tmp[256];
+	FILE *fp;
+	int ret;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		D_DEBUG("cannot write calibration cache %s\n", tmp);
+		return;
+	}
+
+	ret = fprintf(fp, "%s %d.%d %d %d\n", calib_backend(ctx),
+		      ctx->dev->major, ctx->dev->minor,
+		      calib->fill, calib->copy);
+
+	if (fclose(fp) || ret < 0 || rename(tmp, path)) {
+		D_DEBUG("cannot write calibration cache %s\n", path);
+		unlink(tmp);
+	}
+}
+
+drm_public
+int nexell_g2d_calibrate(struct nx_g2d_ctx *ctx, const char *path,
+			 struct nx_g2d_calib *calib)
+{
+	int ret;
+
+	if (!path)
+		path = getenv("NEXELL_G2D_CALIBRATE");
+
+	if (!path || !*path || !strcmp(path, "0"))
+		return 1;
+
+	if (!strcmp(path, "1"))
+		path = NX_G2D_CALIB_FILE;
+
+	calib->cached = 1;
+
+	if (calib_load(ctx, path, calib) < 0) {
+		calib->cached = 0;
+
+		ret = calib_measure(ctx, calib);
+		if (ret < 0)
+			return ret;
+
+		calib_save(ctx, path, calib);
+	}
+
+	ctx->cpu_fill_threshold = calib->fill;
+	ctx->cpu_copy_threshold = calib->copy;
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * Command capture
+ *
+ * Every command handed to the engine is written as is, with the size of
+ * the buffer area each handle has used so far, so that nexell_g2d_replay
+ * can allocate buffers and run the same command stream elsewhere. The
+ * operations done on the CPU are not part of the stream.
+ */
+
+#define CAPTURE_BUFS	256	/* handles with a known size, power of 2 */
+
+struct nx_g2d_capture {
+	FILE *fp;
+	__u64 start;
+	struct {
+		unsigned int handle;
+		unsigned long size;
+	} bufs[CAPTURE_BUFS];
+};
+
+static void
+capture_stop(struct nx_g2d_ctx *ctx)
+{
+	D_ERROR("%s() capture write failed, stopped\n", __func__);
+	fclose(ctx->capture->fp);
+	free(ctx->capture);
+	ctx->capture = NULL;
+}
+
+static bool
+capture_rec(struct nx_g2d_capture *cap, __u32 type, __u32 count, __u64 arg)
+{
+	struct nx_g2d_capture_rec rec = {
+		.type = type,
+		.count = count,
+		.ts = nx_g2d_time_ns() - cap->start,
+		.arg = arg,
+	};
+
+	return fwrite(&rec, sizeof(rec), 1, cap->fp) == 1;
+}
+
+/* a BUFFER record when the handle is new or used further than before */
+static bool
+capture_buf(struct nx_g2d_capture *cap, unsigned int handle,
+	    unsigned long end)
+{
+	unsigned int i, n;
+
+	if (!end)
+		return true;
+
+	for (i = handle, n = 0; n < CAPTURE_BUFS; i++, n++) {
+		i &= CAPTURE_BUFS - 1;
+
+		if (cap->bufs[i].size && cap->bufs[i].handle != handle)
+			continue;
+
+		if (cap->bufs[i].size >= end)
+			return true;
+
+		cap->bufs[i].handle = handle;
+		cap->bufs[i].size = end;
+		break;
+	}
+
+	/* no slot left, always recorded */
+	return capture_rec(cap, NX_G2D_CAPTURE_BUFFER, handle, end);
+}
+
+void nx_g2d_capture_init(struct nx_g2d_ctx *ctx)
+{
+	const char *env = getenv("NEXELL_G2D_CAPTURE");
+	struct nx_g2d_capture_hdr hdr = {
+		.magic = NX_G2D_CAPTURE_MAGIC,
+		.version = NX_G2D_CAPTURE_VERSION,
+		.cmd_size = sizeof(struct nx_g2d_cmd),
+		.sw = ctx->dev->sw != NULL,
+	};
+	struct nx_g2d_capture *cap;
+	char *path;
+
+	if (!env || !*env)
+		return;
+
+	path = malloc(strlen(env) + 16);
+	if (!path)
+		return;
+
+	if (ctx->id)
+		sprintf(path, "%s.%d", env, ctx->id);
+	else
+		strcpy(path, env);
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		goto out;
+
+	cap->fp = fopen(path, "wb");
+	if (!cap->fp) {
+		D_ERROR("%s() cannot create capture %s\n", __func__, path);
+		free(cap);
+		goto out;
+	}
+
+	cap->start = nx_g2d_time_ns();
+	ctx->capture = cap;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, cap->fp) != 1)
+		capture_stop(ctx);
+	else
+		D_DEBUG("command capture %s\n", path);
+
+out:
+	free(path);
+}
+
+void nx_g2d_capture_free(struct nx_g2d_ctx *ctx)
+{
+	if (!ctx->capture)
+		return;
+
+	if (fclose(ctx->capture->fp))
+		D_ERROR("%s() capture write failed\n", __func__);
+
+	free(ctx->capture);
+	ctx->capture = NULL;
+}
+
+void nx_g2d_capture_submit(struct nx_g2d_ctx *ctx,
+			   const struct nx_g2d_cmd *cmds, int count)
+{
+	struct nx_g2d_capture *cap = ctx->capture;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!capture_buf(cap, cmds[i].src.handle,
+				 nx_g2d_sw_area_end(&cmds[i], true)) ||
+		    !capture_buf(cap, cmds[i].dst.handle,
+				 nx_g2d_sw_area_end(&cmds[i], false)))
+			goto err;
+	}
+
+	/* the serials are given when queued */
+	if (!capture_rec(cap, NX_G2D_CAPTURE_SUBMIT, count,
+			 ctx->serial - count + 1) ||
+	    fwrite(cmds, sizeof(*cmds), count, cap->fp) != (size_t)count)
+		goto err;
+
+	return;
+
+err:
+	capture_stop(ctx);
+}
+
+void nx_g2d_capture_sync(struct nx_g2d_ctx *ctx, __u64 serial)
+{
+	if (!capture_rec(ctx->capture, NX_G2D_CAPTURE_SYNC, 0, serial))
+		capture_stop(ctx);
+}
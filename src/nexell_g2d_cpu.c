@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NX_G2D_CPU_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define NX_G2D_CPU_SSE2
+#endif
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * CPU fill and copy kernels
+ *
+ * Used for operations too small to be worth a G2D command.
+ * The vector paths store 16 bytes per step with NEON or SSE2,
+ * the remainder of each line is written per pixel.
+ */
+
+#if defined(NX_G2D_CPU_NEON)
+typedef uint8x16_t vec16_t;
+#define VEC_LOAD(p)		vld1q_u8((const uint8_t *)(p))
+#define VEC_STORE(p, v)		vst1q_u8((uint8_t *)(p), v)
+#elif defined(NX_G2D_CPU_SSE2)
+typedef __m128i vec16_t;
+#define VEC_LOAD(p)		_mm_loadu_si128((const __m128i *)(p))
+#define VEC_STORE(p, v)		_mm_storeu_si128((__m128i *)(p), v)
+#endif
+
+static inline void
+cpu_store_pixel(unsigned char *p, int pixelbyte, unsigned int pixel)
+{
+	p[0] = pixel;
+	p[1] = pixel >> 8;
+	if (pixelbyte > 2)
+		p[2] = pixel >> 16;
+	if (pixelbyte > 3)
+		p[3] = pixel >> 24;
+}
+
+void nx_g2d_cpu_fill(unsigned char *dst, int pitch, int width, int height,
+		     int pixelbyte, unsigned int pixel)
+{
+	int linesize = width * pixelbyte;
+	unsigned char pattern[48];
+	int x, y, n = 0;
+
+	/* 48 bytes hold a whole number of 16, 24 and 32 bit pixels */
+	for (x = 0; x < (int)sizeof(pattern); x += pixelbyte)
+		cpu_store_pixel(pattern + x, pixelbyte, pixel);
+
+#if defined(NX_G2D_CPU_NEON) || defined(NX_G2D_CPU_SSE2)
+	{
+		vec16_t v0 = VEC_LOAD(pattern);
+		vec16_t v1 = VEC_LOAD(pattern + 16);
+		vec16_t v2 = VEC_LOAD(pattern + 32);
+
+		n = linesize - linesize % 48;
+
+		for (y = 0; y < height; y++) {
+			unsigned char *p = dst + y * pitch;
+
+			for (x = 0; x < n; x += 48) {
+				VEC_STORE(p + x, v0);
+				VEC_STORE(p + x + 16, v1);
+				VEC_STORE(p + x + 32, v2);
+			}
+		}
+	}
+#endif
+
+	/* the tail, or whole lines without vectors */
+	for (y = 0; y < height; y++) {
+		unsigned char *p = dst + y * pitch;
+
+		for (x = n; x < linesize; x += 48)
+			memcpy(p + x, pattern,
+			       linesize - x < 48 ? linesize - x : 48);
+	}
+}
+
+static inline void
+cpu_copy_line(unsigned char *dst, const unsigned char *src, int linesize)
+{
+	int x = 0;
+
+#if defined(NX_G2D_CPU_NEON) || defined(NX_G2D_CPU_SSE2)
+	for (; x + 32 <= linesize; x += 32) {
+		vec16_t v0 = VEC_LOAD(src + x);
+		vec16_t v1 = VEC_LOAD(src + x + 16);
+
+		VEC_STORE(dst + x, v0);
+		VEC_STORE(dst + x + 16, v1);
+	}
+#endif
+	if (x < linesize)
+		memcpy(dst + x, src + x, linesize - x);
+}
+
+void nx_g2d_cpu_copy(unsigned char *dst, int dst_pitch,
+		     const unsigned char *src, int src_pitch,
+		     int linesize, int height)
+{
+	int y;
+
+	/* overlapping lines of one buffer: keep the copy direction safe */
+	if (dst < src + src_pitch * (height - 1) + linesize &&
+	    src < dst + dst_pitch * (height - 1) + linesize) {
+		if (dst > src) {
+			for (y = height - 1; y >= 0; y--)
+				memmove(dst + y * dst_pitch,
+					src + y * src_pitch, linesize);
+		} else {
+			for (y = 0; y < height; y++)
+				memmove(dst + y * dst_pitch,
+					src + y * src_pitch, linesize);
+		}
+		return;
+	}
+
+	for (y = 0; y < height; y++)
+		cpu_copy_line(dst + y * dst_pitch, src + y * src_pitch,
+			      linesize);
+}
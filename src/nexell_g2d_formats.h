@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _NXP3220_G2D_FORMATS_H_
+#define _NXP3220_G2D_FORMATS_H_
+
+#include "nexell_g2d.h"
+
+/* format capabilities */
+#define NXG2D_FORMAT_SOURCE		BIT(0)	/* SRC_CTRL: blit source */
+#define NXG2D_FORMAT_DESTINATION	BIT(1)	/* DST_CTRL: fill and blit */
+#define NXG2D_FORMAT_RW		(NXG2D_FORMAT_SOURCE | NXG2D_FORMAT_DESTINATION)
+
+/*
+ * Pixel formats of the gfxdriver, also swept by the benchmark.
+ * F(name, format, order, pixelbyte, caps), name is the DSPF_ suffix.
+ */
+#define NXG2D_FORMATS(F) \
+	F(RGB16, NX_G2D_PIXEL_FMT_RGB565, NX_G2D_PIXEL_ORDER_ARGB, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(RGB555, NX_G2D_PIXEL_FMT_XRGB1555, NX_G2D_PIXEL_ORDER_ARGB, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(BGR555, NX_G2D_PIXEL_FMT_XRGB1555, NX_G2D_PIXEL_ORDER_ABGR, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(ARGB1555, NX_G2D_PIXEL_FMT_ARGB1555, NX_G2D_PIXEL_ORDER_ARGB, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(RGBA5551, NX_G2D_PIXEL_FMT_ARGB1555, NX_G2D_PIXEL_ORDER_RGBA, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(RGB444, NX_G2D_PIXEL_FMT_XRGB4444, NX_G2D_PIXEL_ORDER_ARGB, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(ARGB4444, NX_G2D_PIXEL_FMT_ARGB4444, NX_G2D_PIXEL_ORDER_ARGB, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(RGBA4444, NX_G2D_PIXEL_FMT_ARGB4444, NX_G2D_PIXEL_ORDER_RGBA, 2, \
+	  NXG2D_FORMAT_RW) \
+	F(RGB24, NX_G2D_PIXEL_FMT_RGB888, NX_G2D_PIXEL_ORDER_ARGB, 3, \
+	  NXG2D_FORMAT_RW) \
+	F(RGB32, NX_G2D_PIXEL_FMT_XRGB8888, NX_G2D_PIXEL_ORDER_ARGB, 4, \
+	  NXG2D_FORMAT_RW) \
+	F(ARGB, NX_G2D_PIXEL_FMT_ARGB8888, NX_G2D_PIXEL_ORDER_ARGB, 4, \
+	  NXG2D_FORMAT_RW) \
+	F(ABGR, NX_G2D_PIXEL_FMT_ARGB8888, NX_G2D_PIXEL_ORDER_ABGR, 4, \
+	  NXG2D_FORMAT_RW)
+
+#endif /* _NXP3220_G2D_FORMATS_H_ */
@@ -36,9 +36,19 @@
 #include <drmkms_system/drmkms_system.h>
 
 #include "nexell_g2d_gfxdriver.h"
+#include "nexell_g2d_formats.h"
 
 D_DEBUG_DOMAIN(NEXELL_2D, "Nexell/G2D", "Nexell G2D Acceleration");
 
+/*
+ * Per operation messages, with the "Nexell/G2D" domain disabled their
+ * arguments (format names included) are not even evaluated.
+ */
+#define NX_DEBUG_AT(x...) do { \
+		if (D_DEBUG_CHECK(NEXELL_2D)) \
+			D_DEBUG_AT(NEXELL_2D, x); \
+	} while (0)
+
 #include <core/graphics_driver.h>
 
 DFB_GRAPHICS_DRIVER(nexell)
@@ -48,25 +58,189 @@ typedef struct {
 	DFBSurfacePixelFormat dfb_pixelformat;
 	enum nx_g2d_pixel_format pixelformat;
 	int pixelbyte, pixelorder;
+	unsigned int caps;
 } NXG2DSurfacePixelFormat;
 
+#define NXG2D_FORMAT(name, format, order, pixelbyte, caps) \
+	{ DSPF_##name, format, pixelbyte, order, caps },
+
 static NXG2DSurfacePixelFormat NXG2DSupportPixelFormats[] = {
-	{ DSPF_RGB16, NX_G2D_PIXEL_FMT_RGB565, 2, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_RGB555, NX_G2D_PIXEL_FMT_XRGB1555, 2, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_BGR555, NX_G2D_PIXEL_FMT_XRGB1555, 2, NX_G2D_PIXEL_ORDER_ABGR },
-	{ DSPF_ARGB1555, NX_G2D_PIXEL_FMT_ARGB1555, 2, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_RGBA5551, NX_G2D_PIXEL_FMT_ARGB1555, 2, NX_G2D_PIXEL_ORDER_RGBA },
-	{ DSPF_RGB444, NX_G2D_PIXEL_FMT_XRGB4444, 2, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_ARGB4444, NX_G2D_PIXEL_FMT_ARGB4444, 2, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_RGBA4444, NX_G2D_PIXEL_FMT_ARGB4444, 2, NX_G2D_PIXEL_ORDER_RGBA },
-	{ DSPF_RGB24, NX_G2D_PIXEL_FMT_RGB888, 3, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_RGB32, NX_G2D_PIXEL_FMT_XRGB8888, 4, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_ARGB, NX_G2D_PIXEL_FMT_ARGB8888, 4, NX_G2D_PIXEL_ORDER_ARGB },
-	{ DSPF_ABGR, NX_G2D_PIXEL_FMT_ARGB8888, 4, NX_G2D_PIXEL_ORDER_ABGR },
+	NXG2D_FORMATS(NXG2D_FORMAT)
 };
 
 #define DFB_SUPPORT_FORMAT_SIZE	D_ARRAY_SIZE(NXG2DSupportPixelFormats)
 
+/*
+ * DFB_PIXELFORMAT_INDEX() (7 bits) to supported format, NULL if not
+ * supported. Built at driver init, lookups are a load and a compare.
+ */
+#define NXG2D_FORMAT_INDEX_SIZE	0x80
+
+static const NXG2DSurfacePixelFormat *NXG2DFormatIndex[NXG2D_FORMAT_INDEX_SIZE];
+
+static void
+nx_format_index_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < DFB_SUPPORT_FORMAT_SIZE; i++) {
+		const NXG2DSurfacePixelFormat *nxformat =
+			&NXG2DSupportPixelFormats[i];
+
+		NXG2DFormatIndex[DFB_PIXELFORMAT_INDEX(nxformat->dfb_pixelformat)] =
+			nxformat;
+	}
+}
+
+static inline const NXG2DSurfacePixelFormat *
+nx_format(DFBSurfacePixelFormat format, unsigned int caps)
+{
+	const NXG2DSurfacePixelFormat *nxformat =
+		NXG2DFormatIndex[DFB_PIXELFORMAT_INDEX(format)];
+
+	if (!nxformat || nxformat->dfb_pixelformat != format ||
+	    (nxformat->caps & caps) != caps)
+		return NULL;
+
+	return nxformat;
+}
+
+/* DirectFB blend functions to G2D blend factors, -1 not supported */
+static const int NXG2DBlendFuncs[] = {
+	[DSBF_UNKNOWN] = -1,
+	[DSBF_ZERO] = GL_BLEND_ZERO,
+	[DSBF_ONE] = GL_BLEND_ONE,
+	[DSBF_SRCCOLOR] = GL_BLEND_SRC_COLOR,
+	[DSBF_INVSRCCOLOR] = GL_BLEND_ONE_MINUS_SRC_COLOR,
+	[DSBF_SRCALPHA] = GL_BLEND_SRC_ALPHA,
+	[DSBF_INVSRCALPHA] = GL_BLEND_ONE_MINUS_SRC_ALPHA,
+	[DSBF_DESTALPHA] = GL_BLEND_DST_ALPHA,
+	[DSBF_INVDESTALPHA] = GL_BLEND_ONE_MINUS_DST_ALPHA,
+	[DSBF_DESTCOLOR] = GL_BLEND_DST_COLOR,
+	[DSBF_INVDESTCOLOR] = GL_BLEND_ONE_MINUS_DST_COLOR,
+	[DSBF_SRCALPHASAT] = GL_BLEND_SRC_ALPHA_SATURATE,
+};
+
+static inline int
+nx_blend_func(DFBSurfaceBlendFunction func)
+{
+	if ((unsigned int)func >= D_ARRAY_SIZE(NXG2DBlendFuncs))
+		return -1;
+
+	return NXG2DBlendFuncs[func];
+}
+
+/*
+ * Blend factors of the state source and destination blend functions.
+ * A premultiplied source is Sc * Sa * Fs, only for Fs ONE or ZERO.
+ */
+static bool
+nx_blend_funcs(CardState *state, bool premultiply,
+	       struct nx_g2d_blend *blend)
+{
+	int src_func = nx_blend_func(state->src_blend);
+	int dst_func = nx_blend_func(state->dst_blend);
+
+	if (src_func < 0 || dst_func < 0)
+		return false;
+
+	blend->enable = 1;
+	blend->src_rgb = src_func;
+	blend->dst_rgb = dst_func;
+	blend->src_alpha = src_func;
+	blend->dst_alpha = dst_func;
+
+	if (premultiply) {
+		if (state->src_blend == DSBF_ONE)
+			blend->src_rgb = GL_BLEND_SRC_ALPHA;
+		else if (state->src_blend != DSBF_ZERO)
+			return false;
+	}
+
+	return true;
+}
+
+/* premultiplied copy: Sc * Sa, Sa */
+static void
+nx_blend_premultiply(struct nx_g2d_blend *blend)
+{
+	blend->enable = 1;
+	blend->src_rgb = GL_BLEND_SRC_ALPHA;
+	blend->dst_rgb = GL_BLEND_ZERO;
+	blend->src_alpha = GL_BLEND_ONE;
+	blend->dst_alpha = GL_BLEND_ZERO;
+}
+
+/*
+ * Maps the blitting flags and blend functions of the state to the G2D
+ * blend registers, with 'alpha' as the color alpha. Returns false if
+ * the hardware can't express them.
+ */
+static bool
+nx_blit_blend(CardState *state, u8 alpha, struct nx_g2d_blend *blend)
+{
+	DFBSurfaceBlittingFlags flags = state->blittingflags;
+
+	memset(blend, 0, sizeof(*blend));
+
+	blend->equat_rgb = GL_EQUATION_FUNC_ADD;
+	blend->equat_alpha = GL_EQUATION_FUNC_ADD;
+
+	if (!(flags & (DSBLIT_BLEND_ALPHACHANNEL | DSBLIT_BLEND_COLORALPHA))) {
+		if (flags & DSBLIT_SRC_PREMULTIPLY)
+			nx_blend_premultiply(blend);
+		return true;
+	}
+
+	if (flags & DSBLIT_BLEND_COLORALPHA) {
+		if (flags & DSBLIT_BLEND_ALPHACHANNEL) {
+			/* source alpha * color alpha has no register */
+			if (alpha != 0xff)
+				return false;
+		} else {
+			/* the color alpha replaces the source alpha */
+			blend->force_alpha = 1;
+			blend->alpha = alpha;
+		}
+	}
+
+	return nx_blend_funcs(state,
+			      flags & DSBLIT_SRC_PREMULTIPLY, blend);
+}
+
+/*
+ * Drawing flags to the G2D blend registers, the source is the solid
+ * fill color. XOR is a ROP and can't be combined with the blend equation.
+ */
+static bool
+nx_draw_blend(CardState *state, struct nx_g2d_blend *blend)
+{
+	DFBSurfaceDrawingFlags flags = state->drawingflags;
+
+	memset(blend, 0, sizeof(*blend));
+
+	blend->equat_rgb = GL_EQUATION_FUNC_ADD;
+	blend->equat_alpha = GL_EQUATION_FUNC_ADD;
+
+	if (flags & DSDRAW_XOR) {
+		if (flags & (DSDRAW_BLEND | DSDRAW_SRC_PREMULTIPLY))
+			return false;
+
+		blend->rop_enable = 1;
+		blend->rop = GL_BLEND_ROP_XOR;
+		return true;
+	}
+
+	if (!(flags & DSDRAW_BLEND)) {
+		if (flags & DSDRAW_SRC_PREMULTIPLY)
+			nx_blend_premultiply(blend);
+		return true;
+	}
+
+	return nx_blend_funcs(state,
+			      flags & DSDRAW_SRC_PREMULTIPLY, blend);
+}
+
 enum {
 	DESTINATION  = BIT(0),
 	CLIP         = BIT(1),
@@ -77,7 +251,9 @@ enum {
 	COLOR_BLIT   = BIT(8),
 	BLIT_BLEND   = BIT(9),
 	DRAW_BLEND   = BIT(10),
-	ALL          = BIT(11) - 1,
+	FILL_STATE   = BIT(11),
+	BLIT_STATE   = BIT(12),
+	ALL          = BIT(13) - 1,
 };
 
 #define NXG2D_VALIDATE(flags)		(nxdev->v_flags |= (flags))
@@ -89,6 +265,63 @@ enum {
 		} \
 	} while (0)
 
+/*
+ * Surfaces preallocated with a dma-buf fd as handle, from a camera, a
+ * decoder or another process, are imported through the library cache.
+ * The import is held until the state surface changes, the handle is
+ * compiled into the fill and blit states. A pool that imported the
+ * buffer on the same fd has its handle in the lock, left to the pool.
+ */
+static bool
+nx_dmabuf_handle(NXG2DDriverData *nxdrv, u32 *imported,
+		 CoreSurface *surface, CoreSurfaceBufferLock *lock, u32 *handle)
+{
+	CoreSurfaceConfig *config = &surface->config;
+	int index = lock->buffer->index;
+	u32 held = *imported;
+
+	*imported = 0;
+
+	if ((config->flags & CSCONF_PREALLOCATED) &&
+	    config->preallocated[index].handle &&
+	    !nexell_g2d_import(nxdrv->ctx,
+			       (int)(long)config->preallocated[index].handle,
+			       (u32)lock->handle, handle))
+		*imported = *handle;
+
+	/* put after the import, the same buffer is not released in between */
+	if (held)
+		nexell_g2d_import_put(nxdrv->ctx, held);
+
+	return *imported != 0;
+}
+
+/*
+ * CPU mapping of a gem handle for the software engine, replacing the
+ * binding of the previous surface unless the other state surface still
+ * uses it. handle 0 only releases the previous binding.
+ */
+static void
+nx_bind(NXG2DDriverData *nxdrv, u32 *bound, u32 other,
+	u32 handle, void *addr, unsigned int size)
+{
+	if (*bound && *bound != handle && *bound != other)
+		nexell_g2d_unbind(nxdrv->ctx, *bound);
+
+	*bound = 0;
+
+	if (!handle)
+		return;
+
+	if (nexell_g2d_bind(nxdrv->ctx, handle, addr, size) < 0) {
+		D_ERROR("%s failed to bind handle 0x%x\n",
+			DFB_G2D_DRIVER_NAME, handle);
+		return;
+	}
+
+	*bound = handle;
+}
+
 /*
  * Set State routines
  */
@@ -99,34 +332,54 @@ nx_SOURCE(NXG2DDriverData *nxdrv,
 {
 	CoreSurface *surface = state->source;
 	DFBSurfacePixelFormat format = surface->config.format;
-	NXG2DSurfacePixelFormat *nxformat = NXG2DSupportPixelFormats;
+	const NXG2DSurfacePixelFormat *nxformat =
+		nx_format(format, NXG2D_FORMAT_SOURCE);
 	NXG2DImageObject *obj = &nxdev->source;
-	int i;
 
-	D_DEBUG_AT(NEXELL_2D, "%s() %s:%s, addr:0x%08x, size:%d, handle:0x%x\n",
+	NX_DEBUG_AT("%s() %s:%s, addr:0x%08x, size:%d, handle:0x%x\n",
 		__FUNCTION__, dfb_pixelformat_name(format),
 		dfb_pixelformat_name(state->src.buffer->format),
 		state->src.addr, state->src.allocation->size,
 		state->src.handle);
 
-	for (i  = 0; i < DFB_SUPPORT_FORMAT_SIZE; i++, nxformat++) {
-		if (format == nxformat->dfb_pixelformat) {
-			obj->pixelbyte = nxformat->pixelbyte;
-			obj->pixelformat = nxformat->pixelformat;
-			obj->pixelorder = nxformat->pixelorder;
-			obj->pitch = state->src.pitch;
-			/* gem buffer handle */
-			obj->type = NX_G2D_BUF_TYPE_GEM;
-			obj->handle = (u32)state->src.handle;
-			break;
-		}
-	}
-
-	if (i == DFB_SUPPORT_FORMAT_SIZE)
+	if (!nxformat) {
 		D_BUG("Unexpected source pixelformat: %s\n",
 			dfb_pixelformat_name(format));
+		return;
+	}
 
-	D_DEBUG_AT(NEXELL_2D, "%s() %s (%d:%d), byte:%d, pitch:%d, handle:%d\n",
+	obj->pixelbyte = nxformat->pixelbyte;
+	obj->pixelformat = nxformat->pixelformat;
+	obj->pixelorder = nxformat->pixelorder;
+	obj->pitch = state->src.pitch;
+	obj->vaddr = state->src.addr;
+
+	if (nx_dmabuf_handle(nxdrv, &nxdev->source_import, surface,
+			     &state->src, &obj->handle)) {
+		obj->type = NX_G2D_BUF_TYPE_GEM;
+		nx_bind(nxdrv, &nxdev->source_bound, nxdev->destination_bound,
+			0, NULL, 0);
+		return;
+	}
+
+	/* no buffer handle, read by the CPU in the library */
+	if (!state->src.handle) {
+		obj->type = NX_G2D_BUF_TYPE_USER;
+		obj->handle = 0;
+		nx_bind(nxdrv, &nxdev->source_bound, nxdev->destination_bound,
+			0, NULL, 0);
+		return;
+	}
+
+	/* gem buffer handle */
+	obj->type = NX_G2D_BUF_TYPE_GEM;
+	obj->handle = (u32)state->src.handle;
+
+	/* CPU mapping for the software engine */
+	nx_bind(nxdrv, &nxdev->source_bound, nxdev->destination_bound,
+		obj->handle, state->src.addr, state->src.allocation->size);
+
+	NX_DEBUG_AT("%s() %s (%d:%d), byte:%d, pitch:%d, handle:%d\n",
 		__FUNCTION__, dfb_pixelformat_name(format),
 		obj->pixelformat, obj->pixelorder, obj->pixelbyte,
 		obj->pitch, obj->handle);
@@ -139,33 +392,43 @@ nx_DESTINATION(NXG2DDriverData *nxdrv,
 {
 	CoreSurface *surface = state->destination;
 	DFBSurfacePixelFormat format = surface->config.format;
-	NXG2DSurfacePixelFormat *nxformat = NXG2DSupportPixelFormats;
+	const NXG2DSurfacePixelFormat *nxformat =
+		nx_format(format, NXG2D_FORMAT_DESTINATION);
 	NXG2DImageObject *obj = &nxdev->destination;
-	int i;
 
-	D_DEBUG_AT(NEXELL_2D, "%s() %s:%s, addr:0x%08x, size:%d, handle:0x%x\n",
+	NX_DEBUG_AT("%s() %s:%s, addr:0x%08x, size:%d, handle:0x%x\n",
 		__FUNCTION__, dfb_pixelformat_name(format),
 		dfb_pixelformat_name(state->dst.buffer->format),
 		state->dst.addr, state->dst.allocation->size, state->dst.handle);
 
-	for (i  = 0; i < DFB_SUPPORT_FORMAT_SIZE; i++, nxformat++) {
-		if (format == nxformat->dfb_pixelformat) {
-			obj->pixelbyte = nxformat->pixelbyte;
-			obj->pixelformat = nxformat->pixelformat;
-			obj->pixelorder = nxformat->pixelorder;
-			obj->pitch = state->dst.pitch;
-			/* gem buffer handle */
-			obj->type = NX_G2D_BUF_TYPE_GEM;
-			obj->handle = (u32)state->dst.handle;
-			break;
-		}
-	}
-
-	if (i == DFB_SUPPORT_FORMAT_SIZE)
+	if (!nxformat) {
 		D_BUG("Unexpected destination pixelformat: %s\n",
 			dfb_pixelformat_name(format));
+		return;
+	}
 
-	D_DEBUG_AT(NEXELL_2D, "%s() %s (%d:%d), byte:%d, pitch:%d, handle:%d\n",
+	obj->pixelbyte = nxformat->pixelbyte;
+	obj->pixelformat = nxformat->pixelformat;
+	obj->pixelorder = nxformat->pixelorder;
+	obj->pitch = state->dst.pitch;
+	obj->vaddr = state->dst.addr;
+	/* gem buffer handle */
+	obj->type = NX_G2D_BUF_TYPE_GEM;
+
+	if (nx_dmabuf_handle(nxdrv, &nxdev->destination_import, surface,
+			     &state->dst, &obj->handle)) {
+		nx_bind(nxdrv, &nxdev->destination_bound, nxdev->source_bound,
+			0, NULL, 0);
+		return;
+	}
+
+	obj->handle = (u32)state->dst.handle;
+
+	/* CPU mapping for the software engine */
+	nx_bind(nxdrv, &nxdev->destination_bound, nxdev->source_bound,
+		obj->handle, state->dst.addr, state->dst.allocation->size);
+
+	NX_DEBUG_AT("%s() %s (%d:%d), byte:%d, pitch:%d, handle:%d\n",
 		__FUNCTION__, dfb_pixelformat_name(format),
 		obj->pixelformat, obj->pixelorder, obj->pixelbyte,
 		obj->pitch, obj->handle);
@@ -181,7 +444,7 @@ nx_COLOR(NXG2DDriverData *nxdrv,
 					state->color.g,
 					state->color.b);
 
-	D_DEBUG_AT(NEXELL_2D,
+	NX_DEBUG_AT(
 		"%s() A:0x%02x, R:0x%02x, G:0x%02x, B:0x%02x, color:0x%08x\n",
 		__FUNCTION__,
 		state->color.a, state->color.r, state->color.g, state->color.b,
@@ -200,71 +463,154 @@ nx_CLIP(NXG2DDriverData *nxdrv,
 	nxdev->clip.y1 = clip->y1;
 	nxdev->clip.y2 = clip->y2 + 1;
 
-	D_DEBUG_AT(NEXELL_2D, "%s() clip = L:%d T:%d W:%d H:%d\n",
+	NX_DEBUG_AT("%s() clip = L:%d T:%d W:%d H:%d\n",
 		__FUNCTION__, clip->x1, clip->y1,
 		nxdev->clip.x2 - nxdev->clip.x1, nxdev->clip.y2 - nxdev->clip.y1);
 }
 
+static inline void
+nx_BLIT_BLEND(NXG2DDriverData *nxdrv,
+	      NXG2DDeviceData *nxdev,
+	      CardState *state)
+{
+	struct nx_g2d_blend *blend = &nxdev->blit_blend;
+
+	/*
+	 * CheckState is not run again for a new color, a color alpha the
+	 * blend can't take leaves the blits to the software renderer
+	 */
+	nxdev->blit_blend_ok = nx_blit_blend(state, state->color.a, blend);
+
+	NX_DEBUG_AT(
+		"%s() flags:0x%x, blend:%d-%d, %d, rgb:%d/%d, alpha:%d/%d%s\n",
+		__FUNCTION__, state->blittingflags,
+		state->src_blend, state->dst_blend, blend->enable,
+		blend->src_rgb, blend->dst_rgb,
+		blend->src_alpha, blend->dst_alpha,
+		nxdev->blit_blend_ok ? "" : " (software)");
+}
+
+static inline void
+nx_DRAW_BLEND(NXG2DDriverData *nxdrv,
+	      NXG2DDeviceData *nxdev,
+	      CardState *state)
+{
+	struct nx_g2d_blend *blend = &nxdev->draw_blend;
+
+	nx_draw_blend(state, blend);
+
+	NX_DEBUG_AT(
+		"%s() flags:0x%x, blend:%d-%d, %d, rop:%d, rgb:%d/%d, alpha:%d/%d\n",
+		__FUNCTION__, state->drawingflags,
+		state->src_blend, state->dst_blend, blend->enable,
+		blend->rop_enable, blend->src_rgb, blend->dst_rgb,
+		blend->src_alpha, blend->dst_alpha);
+}
+
+static inline void
+nx_FILL_STATE(NXG2DDriverData *nxdrv,
+	      NXG2DDeviceData *nxdev,
+	      CardState *state)
+{
+	struct nx_g2d_image img = { 0, };
+
+	img.dst = nxdev->destination;
+	img.dst.offset = 0;
+	img.blend = nxdev->draw_blend;
+
+	img.fillcolor = nxdev->fillcolor;
+	img.blendcolor = RGBA_COLOR(0xff, 0xff, 0xff, 0xff);
+
+	nexell_g2d_state_fill(&nxdev->fill_state, &img);
+
+	NX_DEBUG_AT("%s()\n", __FUNCTION__);
+}
+
+static inline void
+nx_BLIT_STATE(NXG2DDriverData *nxdrv,
+	      NXG2DDeviceData *nxdev,
+	      CardState *state)
+{
+	struct nx_g2d_image img = { 0, };
+
+	img.dst = nxdev->destination;
+	img.dst.offset = 0;
+	img.src = nxdev->source;
+	img.src.offset = 0;
+	img.blend = nxdev->blit_blend;
+
+	img.fillcolor = nxdev->fillcolor;
+	img.blendcolor = RGBA_COLOR(0xff, 0xff, 0xff, 0xff);
+
+	nexell_g2d_state_blit(&nxdev->blit_state, &img);
+
+	NX_DEBUG_AT("%s()\n", __FUNCTION__);
+}
+
 static void
-nxCheckState(void *drv, void *dev,
-	       CardState *state, DFBAccelerationMask accel)
+nx_check_state(CardState *state, DFBAccelerationMask accel)
 {
 	DFBSurfacePixelFormat dst_format = state->destination->config.format;
 	DFBSurfacePixelFormat src_format =
 		DFB_BLITTING_FUNCTION(accel) ? state->source->config.format : DSPF_UNKNOWN;
-	NXG2DSurfacePixelFormat *nxformat = NXG2DSupportPixelFormats;
-	int i;
 
-	D_DEBUG_AT(NEXELL_2D,
+	NX_DEBUG_AT(
 		"%s() accel:0x%x(state:0x%x), drawing:0x%x, blitting:0x%x\n",
 		__FUNCTION__, accel, state->accel,
 		state->drawingflags, state->blittingflags);
 
-	D_DEBUG_AT(NEXELL_2D, "%s() %s: format:%s -> %s\n",
+	NX_DEBUG_AT("%s() %s: format:%s -> %s\n",
 		__FUNCTION__, DFB_DRAWING_FUNCTION(accel) ? "DRAW" : "BLIT",
 		dfb_pixelformat_name(dst_format),
 		src_format != DSPF_UNKNOWN ? dfb_pixelformat_name(src_format) : "None");
 
-	/*
-	 * Check Source Format
-	 */
-	if (src_format != DSPF_UNKNOWN && DFB_COLOR_IS_YUV(src_format))
+	/* YUV and other unsupported formats are not in the index */
+	if (src_format != DSPF_UNKNOWN &&
+	    !nx_format(src_format, NXG2D_FORMAT_SOURCE))
 		return;
 
-	for (i  = 0; src_format != DSPF_UNKNOWN &&
-	     i < DFB_SUPPORT_FORMAT_SIZE; i++, nxformat++) {
-		if (src_format == nxformat->dfb_pixelformat)
-			break;
-	}
-
-	if (i == DFB_SUPPORT_FORMAT_SIZE)
+	if (!nx_format(dst_format, NXG2D_FORMAT_DESTINATION))
 		return;
 
-	/*
-	 * Check Destination Format
-	 */
-	if (DFB_COLOR_IS_YUV(dst_format))
-		return;
-
-	for (i  = 0; i < DFB_SUPPORT_FORMAT_SIZE; i++, nxformat++) {
-		if (dst_format == nxformat->dfb_pixelformat)
-			break;
-	}
+	if (!(accel & ~NXG2D_SUPPORTED_DRAWINGFUNCTIONS) &&
+	    !(state->drawingflags & ~NXG2D_SUPPORTED_DRAWINGFLAGS)) {
+		struct nx_g2d_blend blend;
 
-	if (i == DFB_SUPPORT_FORMAT_SIZE)
-		return;
+		if (!nx_draw_blend(state, &blend))
+			return;
 
-	if (!(accel & ~NXG2D_SUPPORTED_DRAWINGFUNCTIONS) &&
-	    !(state->drawingflags & ~NXG2D_SUPPORTED_DRAWINGFLAGS))
 		state->accel |= NXG2D_SUPPORTED_DRAWINGFUNCTIONS;
+	}
 
 	if (!(accel & ~NXG2D_SUPPORTED_BLITTINGFUNCTIONS) &&
 	    !(state->blittingflags & ~NXG2D_SUPPORTED_BLITTINGFLAGS)) {
-		if (state->source->config.format == state->destination->config.format)
-			state->accel |= NXG2D_SUPPORTED_BLITTINGFUNCTIONS;
+		struct nx_g2d_blend blend;
+
+		/*
+		 * only the flags and functions, the color alpha is checked
+		 * by SetState as a color change doesn't come back here
+		 */
+		if (!nx_blit_blend(state, 0xff, &blend))
+			return;
+
+		/* SRC_CTRL and DST_CTRL formats are independent */
+		state->accel |= NXG2D_SUPPORTED_BLITTINGFUNCTIONS;
 	}
 }
 
+static void
+nxCheckState(void *drv, void *dev,
+	       CardState *state, DFBAccelerationMask accel)
+{
+	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
+
+	nx_check_state(state, accel);
+
+	/* left to the software renderer */
+	if (!(state->accel & accel))
+		nexell_g2d_stats_fallback(nxdrv->ctx);
+}
+
 static void
 nxSetState(void *drv, void *dev,
 	      GraphicsDeviceFuncs *funcs,
@@ -275,7 +621,7 @@ nxSetState(void *drv, void *dev,
 	NXG2DDeviceData *nxdev = (NXG2DDeviceData *)dev;
 	StateModificationFlags modified = state->mod_hw;
 
-	D_DEBUG_AT(NEXELL_2D, "%s() accel:0x%x(0x%x), modified:0x%x, %p\n",
+	NX_DEBUG_AT("%s() accel:0x%x(0x%x), modified:0x%x, %p\n",
 		__FUNCTION__, accel, state->accel, modified, state->source);
 
 	/*
@@ -284,40 +630,44 @@ nxSetState(void *drv, void *dev,
 	 * one or more hardware states.
 	 */
 	if (modified == SMF_ALL) {
-		D_DEBUG_AT(NEXELL_2D, "  <- ALL\n");
+		NX_DEBUG_AT("  <- ALL\n");
 		NXG2D_INVALIDATE(ALL);
 	} else if (modified) {
 		/* Invalidate destination settings. */
 		if (modified & SMF_DESTINATION) {
-			D_DEBUG_AT(NEXELL_2D, "  <- DESTINATION\n");
-			NXG2D_INVALIDATE(DESTINATION);
+			NX_DEBUG_AT("  <- DESTINATION\n");
+			NXG2D_INVALIDATE(DESTINATION | FILL_STATE | BLIT_STATE);
 		}
 
+		/*
+		 * color alpha is part of the blit blend,
+		 * the fill state only gets the new color patched
+		 */
 		if (modified & SMF_COLOR) {
-			D_DEBUG_AT(NEXELL_2D, "  <- COLOR\n");
-			NXG2D_INVALIDATE(COLOR);
+			NX_DEBUG_AT("  <- COLOR\n");
+			NXG2D_INVALIDATE(COLOR | BLIT_BLEND | BLIT_STATE);
 		}
 
 		/* Invalidate source settings. */
 		if ((modified & SMF_SOURCE) && state->source) {
-			D_DEBUG_AT(NEXELL_2D, "  <- SOURCE\n");
-			NXG2D_INVALIDATE(SOURCE);
+			NX_DEBUG_AT("  <- SOURCE\n");
+			NXG2D_INVALIDATE(SOURCE | BLIT_STATE);
 		}
 
 		/* Invalidate blend function for blitting. */
 		if (modified & (SMF_BLITTING_FLAGS | SMF_SRC_BLEND | SMF_DST_BLEND)) {
-			D_DEBUG_AT(NEXELL_2D, "  <- BLIT_BLEND\n");
-			NXG2D_INVALIDATE(BLIT_BLEND);
+			NX_DEBUG_AT("  <- BLIT_BLEND\n");
+			NXG2D_INVALIDATE(BLIT_BLEND | BLIT_STATE);
 		}
 
 		/* Invalidate blend function for drawing. */
 		if (modified & (SMF_DRAWING_FLAGS | SMF_SRC_BLEND | SMF_DST_BLEND)) {
-			D_DEBUG_AT(NEXELL_2D, "  <- DRAW_BLEND\n");
-			NXG2D_INVALIDATE(DRAW_BLEND);
+			NX_DEBUG_AT("  <- DRAW_BLEND\n");
+			NXG2D_INVALIDATE(DRAW_BLEND | FILL_STATE);
 		}
 
 		if (modified & SMF_CLIP) {
-			D_DEBUG_AT(NEXELL_2D, "  <- CLIP\n");
+			NX_DEBUG_AT("  <- CLIP\n");
 			NXG2D_INVALIDATE(CLIP);
 		}
 	}
@@ -327,16 +677,21 @@ nxSetState(void *drv, void *dev,
 
 	switch (accel) {
 	case DFXL_FILLRECTANGLE:
-		D_DEBUG_AT(NEXELL_2D, "  -> FILLRECTANGLE\n");
+		NX_DEBUG_AT("  -> FILLRECTANGLE\n");
 		NXG2D_CHECK_VALIDATE(COLOR);
+		NXG2D_CHECK_VALIDATE(DRAW_BLEND);
 		NXG2D_CHECK_VALIDATE(CLIP);
+		NXG2D_CHECK_VALIDATE(FILL_STATE);
+		nexell_g2d_state_color(&nxdev->fill_state, nxdev->fillcolor);
 		state->set |= DFXL_FILLRECTANGLE;
 		break;
 	case DFXL_BLIT:
-		D_DEBUG_AT(NEXELL_2D, "  -> BLIT\n");
+		NX_DEBUG_AT("  -> BLIT\n");
 		NXG2D_CHECK_VALIDATE(SOURCE);
 		NXG2D_CHECK_VALIDATE(COLOR);
+		NXG2D_CHECK_VALIDATE(BLIT_BLEND);
 		NXG2D_CHECK_VALIDATE(CLIP);
+		NXG2D_CHECK_VALIDATE(BLIT_STATE);
 		state->set |= DFXL_BLIT;
 		break;
 	default:
@@ -353,33 +708,82 @@ nxSetState(void *drv, void *dev,
 	state->mod_hw = 0;
 }
 
+/*
+ * Clipping against nxdev->clip (x2/y2 exclusive), done before any
+ * command is built so that invisible operations cost nothing.
+ */
+static inline bool
+nx_clip_fill(const DFBRegion *clip, DFBRectangle *rect)
+{
+	int x2 = rect->x + rect->w;
+	int y2 = rect->y + rect->h;
+
+	if (rect->x < clip->x1)
+		rect->x = clip->x1;
+	if (rect->y < clip->y1)
+		rect->y = clip->y1;
+	if (x2 > clip->x2)
+		x2 = clip->x2;
+	if (y2 > clip->y2)
+		y2 = clip->y2;
+
+	rect->w = x2 - rect->x;
+	rect->h = y2 - rect->y;
+
+	return rect->w > 0 && rect->h > 0;
+}
+
+/* clips the destination at dx/dy and moves the source rect along */
+static inline bool
+nx_clip_blit(const DFBRegion *clip, DFBRectangle *srect, int *dx, int *dy)
+{
+	DFBRectangle drect = { *dx, *dy, srect->w, srect->h };
+
+	if (!nx_clip_fill(clip, &drect))
+		return false;
+
+	srect->x += drect.x - *dx;
+	srect->y += drect.y - *dy;
+	srect->w = drect.w;
+	srect->h = drect.h;
+
+	*dx = drect.x;
+	*dy = drect.y;
+
+	return true;
+}
+
 static bool
 nxBlit(void *drv, void *dev, DFBRectangle *rect, int dx, int dy)
 {
 	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
 	NXG2DDeviceData *nxdev = (NXG2DDeviceData *)dev;
-	NXG2DImageObject *src = &nxdev->source;
-	NXG2DImageObject *dst = &nxdev->destination;
-	struct nx_g2d_image img = { 0, };
+	DFBRectangle srect = *rect;
+	struct nx_g2d_rect r;
+	struct nx_g2d_point p;
 
-	D_DEBUG_AT(NEXELL_2D, "%s() X:%d, Y:%d, L:%d T:%d W:%d H:%d\n",
+	NX_DEBUG_AT("%s() X:%d, Y:%d, L:%d T:%d W:%d H:%d\n",
 		__FUNCTION__, dx, dy, rect->x, rect->y, rect->w, rect->h);
-	D_DEBUG_AT(NEXELL_2D, "%s() color:0x%x, L:%d T:%d W:%d H:%d\n",
-		__FUNCTION__, nxdev->fillcolor,
-		rect->x, rect->y, rect->w, rect->h);
 
-	dst->offset = (dx * dst->pixelbyte) + (dy * dst->pitch);
-	src->offset = (rect->x * dst->pixelbyte) + (rect->y * dst->pitch);
+	/* blend of the current color alpha not supported */
+	if (!nxdev->blit_blend_ok) {
+		nexell_g2d_stats_fallback(nxdrv->ctx);
+		return false;
+	}
 
-	img.width = rect->w;
-	img.height = rect->h;
-	img.dst = nxdev->destination;
-	img.src = nxdev->source;
+	/* fully clipped, nothing to do */
+	if (!nx_clip_blit(&nxdev->clip, &srect, &dx, &dy))
+		return true;
 
-	img.fillcolor = nxdev->fillcolor;
-	img.blendcolor = RGBA_COLOR(0xff, 0xff, 0xff, 0xff);
+	r.x = srect.x;
+	r.y = srect.y;
+	r.width = srect.w;
+	r.height = srect.h;
+	p.x = dx;
+	p.y = dy;
 
-	return nexell_g2d_blit(nxdrv->ctx, &img) ? false : true;
+	return nexell_g2d_state_blits(nxdrv->ctx, &nxdev->blit_state,
+				      &r, &p, 1) == 1;
 }
 
 static bool
@@ -387,27 +791,133 @@ nxFillRectangle(void *drv, void *dev, DFBRectangle *rect)
 {
 	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
 	NXG2DDeviceData *nxdev = (NXG2DDeviceData *)dev;
-	NXG2DImageObject *src = &nxdev->source;
 	NXG2DImageObject *dst = &nxdev->destination;
-	struct nx_g2d_image img = { 0, };
-	int ret;
+	DFBRectangle drect = *rect;
+	struct nx_g2d_rect r;
 
-	D_DEBUG_AT(NEXELL_2D,
+	NX_DEBUG_AT(
 		"%s() color:0x%x, L:%d T:%d W:%d H:%d, %dbpp, %dpitch\n",
 		__FUNCTION__, nxdev->fillcolor,
 		rect->x, rect->y, rect->w, rect->h,
 		dst->pixelbyte * 8, dst->pitch);
 
-	dst->offset = (rect->x * dst->pixelbyte) + (rect->y * dst->pitch);
+	/* fully clipped, nothing to do */
+	if (!nx_clip_fill(&nxdev->clip, &drect))
+		return true;
 
-	img.width = rect->w;
-	img.height = rect->h;
-	img.dst = nxdev->destination;
+	r.x = drect.x;
+	r.y = drect.y;
+	r.width = drect.w;
+	r.height = drect.h;
 
-	img.fillcolor = nxdev->fillcolor;
-	img.blendcolor = RGBA_COLOR(0xff, 0xff, 0xff, 0xff);
+	return nexell_g2d_state_fillrects(nxdrv->ctx, &nxdev->fill_state,
+					  &r, 1) == 1;
+}
+
+/* rectangles converted per library call */
+#define NXG2D_RECTS_CHUNK	64
+
+static bool
+nxFillRectangles(void *drv, void *dev, const DFBRectangle *rects,
+		 unsigned int num, unsigned int *done)
+{
+	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
+	NXG2DDeviceData *nxdev = (NXG2DDeviceData *)dev;
+	struct nx_g2d_rect r[NXG2D_RECTS_CHUNK];
+	unsigned int index[NXG2D_RECTS_CHUNK];
+	unsigned int i, n;
+	int ret;
+
+	NX_DEBUG_AT("%s() color:0x%x, num:%u\n",
+		__FUNCTION__, nxdev->fillcolor, num);
+
+	*done = 0;
+
+	while (*done < num) {
+		/* clipped rectangles, fully clipped ones are dropped */
+		for (i = *done, n = 0; i < num && n < NXG2D_RECTS_CHUNK; i++) {
+			DFBRectangle rect = rects[i];
+
+			if (!nx_clip_fill(&nxdev->clip, &rect))
+				continue;
 
-	return nexell_g2d_fillrect(nxdrv->ctx, &img) ? false : true;
+			r[n].x = rect.x;
+			r[n].y = rect.y;
+			r[n].width = rect.w;
+			r[n].height = rect.h;
+			index[n++] = i;
+		}
+
+		ret = n ? nexell_g2d_state_fillrects(nxdrv->ctx,
+				&nxdev->fill_state, r, n) : 0;
+		if (ret != (int)n) {
+			*done = index[ret];
+			return false;
+		}
+		*done = i;
+	}
+
+	return true;
+}
+
+static bool
+nxBatchBlit(void *drv, void *dev, const DFBRectangle *rects,
+	    const DFBPoint *points, unsigned int num, unsigned int *done)
+{
+	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
+	NXG2DDeviceData *nxdev = (NXG2DDeviceData *)dev;
+	struct nx_g2d_rect r[NXG2D_RECTS_CHUNK];
+	struct nx_g2d_point p[NXG2D_RECTS_CHUNK];
+	unsigned int index[NXG2D_RECTS_CHUNK];
+	unsigned int i, n;
+	int ret;
+
+	NX_DEBUG_AT("%s() num:%u\n", __FUNCTION__, num);
+
+	*done = 0;
+
+	if (!nxdev->blit_blend_ok) {
+		nexell_g2d_stats_fallback(nxdrv->ctx);
+		return false;
+	}
+
+	while (*done < num) {
+		for (i = *done, n = 0; i < num && n < NXG2D_RECTS_CHUNK; i++) {
+			DFBRectangle rect = rects[i];
+			int dx = points[i].x, dy = points[i].y;
+
+			if (!nx_clip_blit(&nxdev->clip, &rect, &dx, &dy))
+				continue;
+
+			r[n].x = rect.x;
+			r[n].y = rect.y;
+			r[n].width = rect.w;
+			r[n].height = rect.h;
+			p[n].x = dx;
+			p[n].y = dy;
+			index[n++] = i;
+		}
+
+		ret = n ? nexell_g2d_state_blits(nxdrv->ctx,
+				&nxdev->blit_state, r, p, n) : 0;
+		if (ret != (int)n) {
+			*done = index[ret];
+			return false;
+		}
+		*done = i;
+	}
+
+	return true;
+}
+
+static void
+nxEmitCommands(void *drv, void *dev)
+{
+	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
+
+	if (nexell_g2d_batch_flush(nxdrv->ctx))
+		D_ERROR("%s failed to flush the command batch\n",
+			DFB_G2D_DRIVER_NAME);
 }
 
 static DFBResult
@@ -415,15 +925,38 @@ nxEngineSync(void *drv, void *dev)
 {
 	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
 
-	D_DEBUG_AT(NEXELL_2D, "%s()\n", __FUNCTION__);
+	NX_DEBUG_AT("%s()\n", __FUNCTION__);
 
 	return nexell_g2d_sync(nxdrv->ctx) ? DFB_FAILURE : DFB_OK;
 }
 
+static void
+nxGetSerial(void *drv, void *dev, CoreGraphicsSerial *serial)
+{
+	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
+	u64 value = nexell_g2d_serial(nxdrv->ctx);
+
+	serial->serial = (unsigned int)value;
+	serial->generation = (unsigned int)(value >> 32);
+}
+
+static DFBResult
+nxWaitSerial(void *drv, void *dev, const CoreGraphicsSerial *serial)
+{
+	NXG2DDriverData *nxdrv = (NXG2DDriverData *)drv;
+	u64 value = ((u64)serial->generation << 32) | serial->serial;
+
+	NX_DEBUG_AT("%s() serial:%llu\n",
+		__FUNCTION__, (unsigned long long)value);
+
+	return nexell_g2d_wait(nxdrv->ctx, value) ? DFB_FAILURE : DFB_OK;
+}
+
 static DFBResult
 nxOpen(CoreGraphicsDevice *device, NXG2DDriverData *nxdrv)
 {
 	DRMKMSData *drmkms = dfb_system_data();
+	struct nx_g2d_calib calib;
 	int major, minor;
 	int ret;
 
@@ -437,6 +970,43 @@ nxOpen(CoreGraphicsDevice *device, NXG2DDriverData *nxdrv)
 		DFB_G2D_DRIVER_NAME,
 		NX_G2D_DRIVER_VER_MAJOR, NX_G2D_DRIVER_VER_MINOR, major, minor);
 
+	/*
+	 * queue operations, flushed on EmitCommands, only when the kernel
+	 * takes them in one ioctl: otherwise a batch saves no ioctl and only
+	 * keeps the G2D idle while the CPU renders
+	 */
+	if (nexell_g2d_batch_probe(nxdrv->ctx) > 0) {
+		ret = nexell_g2d_batch_begin(nxdrv->ctx, 0, 0);
+		if (ret) {
+			nexell_g2d_free(nxdrv->ctx);
+			return DFB_NOSYSTEMMEMORY;
+		}
+	}
+
+	/* optional submission thread, NEXELL_G2D_RING */
+	ret = nexell_g2d_ring_begin(nxdrv->ctx, 0);
+	if (ret) {
+		nexell_g2d_free(nxdrv->ctx);
+		return DFB_NOSYSTEMMEMORY;
+	}
+
+	/* optional CPU workers for large operations, NEXELL_G2D_HYBRID */
+	ret = nexell_g2d_hybrid_begin(nxdrv->ctx, 0);
+	if (ret) {
+		nexell_g2d_free(nxdrv->ctx);
+		return DFB_NOSYSTEMMEMORY;
+	}
+
+	/* optional CPU dispatch thresholds, NEXELL_G2D_CALIBRATE */
+	ret = nexell_g2d_calibrate(nxdrv->ctx, NULL, &calib);
+	if (!ret)
+		D_INFO("%s CPU threshold fill:%d copy:%d pixels (%s)\n",
+			DFB_G2D_DRIVER_NAME, calib.fill, calib.copy,
+			calib.cached ? "cached" : "measured");
+	else if (ret < 0)
+		D_WARN("%s calibration failed, default CPU threshold",
+			DFB_G2D_DRIVER_NAME);
+
 	D_FLAGS_SET(nxdrv->flags, NXG2D_FLAGS_OPEN);
 
 	return DFB_OK;
@@ -514,15 +1084,22 @@ driver_init_driver(CoreGraphicsDevice *device,
 
 	nxdrv->dev = device_data;
 
+	nx_format_index_init();
+
 	ret = nxOpen(device, nxdrv);
 	if (ret)
 		return ret;
 
 	funcs->CheckState	= nxCheckState;
 	funcs->SetState         = nxSetState;
+	funcs->EmitCommands     = nxEmitCommands;
 	funcs->EngineSync       = nxEngineSync;
+	funcs->GetSerial        = nxGetSerial;
+	funcs->WaitSerial       = nxWaitSerial;
 	funcs->FillRectangle    = nxFillRectangle;
+	funcs->FillRectangles   = nxFillRectangles;
 	funcs->Blit             = nxBlit;
+	funcs->BatchBlit        = nxBatchBlit;
 
 	return DFB_OK;
 }
@@ -48,22 +48,35 @@
 
 /* CAPT: DRAWING: DFXL_NONE, DFXL_FILLRECTANGLE */
 #define NXG2D_SUPPORTED_DRAWINGFUNCTIONS   \
-		(DFXL_NONE)
+		(DFXL_FILLRECTANGLE)
 #define NXG2D_SUPPORTED_DRAWINGFLAGS	\
-		(DSDRAW_NOFX)
+		(DSDRAW_BLEND | DSDRAW_XOR | DSDRAW_SRC_PREMULTIPLY)
 
 /* CAPT: BLIT : DFXL_NONE, DFXL_BLIT */
 #define NXG2D_SUPPORTED_BLITTINGFUNCTIONS  \
 		(DFXL_BLIT)
 #define NXG2D_SUPPORTED_BLITTINGFLAGS   \
-		(DSBLIT_NOFX)
+		(DSBLIT_BLEND_ALPHACHANNEL | DSBLIT_BLEND_COLORALPHA | \
+		 DSBLIT_SRC_PREMULTIPLY)
 
 typedef struct nx_g2d_image_obj NXG2DImageObject;
 
 typedef struct {
 	NXG2DImageObject source;
 	NXG2DImageObject destination;
+	/* handles bound to the software engine, 0 if none */
+	u32 source_bound;
+	u32 destination_bound;
+	/* dma-buf imports held for the state surfaces, 0 if none */
+	u32 source_import;
+	u32 destination_import;
 	unsigned int fillcolor;
+	struct nx_g2d_blend blit_blend;
+	bool blit_blend_ok;		/* false: blits left to software */
+	struct nx_g2d_blend draw_blend;
+	/* registers compiled from the validated state */
+	struct nx_g2d_state fill_state;
+	struct nx_g2d_state blit_state;
 	DFBRegion clip;
 	/* validation flags */
 	u32 v_flags;
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * CPU worker pool for the hybrid bands
+ *
+ * nx_g2d_pool_run() queues the bands and returns at once, the workers
+ * take one band after the other and nx_g2d_pool_wait() returns when all
+ * bands are done.
+ */
+
+struct nx_g2d_pool {
+	pthread_t threads[NX_G2D_HYBRID_THREADS];
+	int count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	const struct nx_g2d_band *bands;
+	int num;			/* bands of the current run */
+	int next;			/* next band to take */
+	int busy;			/* bands not completed */
+	__u64 end_ns;			/* last band completion */
+	bool stop;
+};
+
+__u64 nx_g2d_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+pool_band(const struct nx_g2d_band *band)
+{
+	if (band->src)
+		nx_g2d_cpu_copy(band->dst, band->dst_pitch,
+				band->src, band->src_pitch,
+				band->width * band->pixelbyte, band->height);
+	else
+		nx_g2d_cpu_fill(band->dst, band->dst_pitch,
+				band->width, band->height,
+				band->pixelbyte, band->pixel);
+}
+
+static void *
+pool_thread(void *data)
+{
+	struct nx_g2d_pool *pool = data;
+	int n;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (!pool->stop && pool->next == pool->num)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->stop)
+			break;
+
+		n = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+		pool_band(&pool->bands[n]);
+		pthread_mutex_lock(&pool->lock);
+
+		if (!--pool->busy) {
+			pool->end_ns = nx_g2d_time_ns();
+			pthread_cond_signal(&pool->done);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct nx_g2d_pool *nx_g2d_pool_create(int threads)
+{
+	struct nx_g2d_pool *pool;
+	int i;
+
+	if (threads > NX_G2D_HYBRID_THREADS)
+		threads = NX_G2D_HYBRID_THREADS;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, pool_thread, pool))
+			break;
+		pool->count++;
+	}
+
+	if (!pool->count) {
+		D_ERROR("%s() Failed to create the worker threads\n", __func__);
+		nx_g2d_pool_destroy(pool);
+		return NULL;
+	}
+
+	D_DEBUG("hybrid worker threads %d\n", pool->count);
+
+	return pool;
+}
+
+void nx_g2d_pool_destroy(struct nx_g2d_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int nx_g2d_pool_threads(struct nx_g2d_pool *pool)
+{
+	return pool->count;
+}
+
+/* bands must stay valid until nx_g2d_pool_wait() */
+void nx_g2d_pool_run(struct nx_g2d_pool *pool,
+		     const struct nx_g2d_band *bands, int num)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->bands = bands;
+	pool->num = num;
+	pool->next = 0;
+	pool->busy = num;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* returns the completion time of the last band */
+__u64 nx_g2d_pool_wait(struct nx_g2d_pool *pool)
+{
+	__u64 end;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	end = pool->end_ns;
+	pthread_mutex_unlock(&pool->lock);
+
+	return end;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <xf86drm.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * DMA-BUF import cache
+ *
+ * Imported buffers are kept by the inode of their dma-buf, which is the
+ * same for every fd of a buffer, so a buffer passed each frame with a
+ * new fd is only imported once. The cached handle holds a reference on
+ * the dma-buf, its inode cannot be reused for another buffer while it is
+ * cached. Before Linux 5.3 all dma-bufs share one anonymous inode, they
+ * are imported every time and kept by their handle instead. When the
+ * cache is full, the least recently used entry that no caller holds and
+ * no queued command of any context uses is released.
+ *
+ * The handles are per DRM fd and the kernel returns the same handle for
+ * every import of a buffer, so the cache is shared by the contexts of a
+ * device. An import returning the handle the caller already has for the
+ * buffer is neither cached nor closed. The software engine maps the
+ * dma-buf and binds it instead, it needs the inodes.
+ */
+
+/* handles of the software engine imports */
+#define IMPORT_HANDLE	0xd0000000
+
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC	0x444d4142	/* linux/magic.h */
+#endif
+
+/* inode of a dma-buf, 0 if shared by all dma-bufs */
+static ino_t
+import_inode(int fd, struct stat *st)
+{
+	struct statfs fs;
+
+	if (fstatfs(fd, &fs) < 0 || fs.f_type != DMA_BUF_MAGIC)
+		return 0;
+
+	return st->st_ino;
+}
+
+static void
+import_release(struct nx_g2d_dev *dev, struct nx_g2d_import *imp)
+{
+	struct drm_gem_close arg = { 0 };
+
+	if (dev->sw) {
+		pthread_mutex_lock(&dev->sw_lock);
+		nx_g2d_sw_unbind(dev->sw, imp->handle);
+		pthread_mutex_unlock(&dev->sw_lock);
+		munmap(imp->vaddr, imp->size);
+	} else {
+		arg.handle = imp->handle;
+		if (drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &arg) < 0)
+			D_ERROR("%s() Failed DRM_IOCTL_GEM_CLOSE\n", __func__);
+	}
+
+	D_DEBUG("release dma-buf inode %lu handle 0x%x\n",
+		(unsigned long)imp->inode, imp->handle);
+
+	memset(imp, 0, sizeof(*imp));
+}
+
+static int
+import_buf(struct nx_g2d_dev *dev, int fd, struct nx_g2d_import *imp)
+{
+	off_t size;
+	int ret;
+
+	if (!dev->sw) {
+		ret = drmPrimeFDToHandle(dev->fd, fd, &imp->handle);
+		if (ret < 0)
+			D_ERROR("%s() Failed to import dma-buf fd %d\n",
+				__func__, fd);
+		return ret;
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size <= 0)
+		return -EINVAL;
+
+	imp->vaddr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  fd, 0);
+	if (imp->vaddr == MAP_FAILED) {
+		imp->vaddr = NULL;
+		return -errno;
+	}
+
+	imp->size = size;
+	imp->handle = IMPORT_HANDLE + (unsigned int)imp->inode;
+
+	pthread_mutex_lock(&dev->sw_lock);
+	ret = nx_g2d_sw_bind(dev->sw, imp->handle, imp->vaddr, imp->size);
+	pthread_mutex_unlock(&dev->sw_lock);
+
+	if (ret < 0) {
+		munmap(imp->vaddr, imp->size);
+		imp->vaddr = NULL;
+	}
+
+	return ret;
+}
+
+/* least recently used entry that can be released, NULL if none */
+static struct nx_g2d_import *
+import_victim(struct nx_g2d_ctx *ctx)
+{
+	struct nx_g2d_import *imp = NULL;
+	int i;
+
+	for (i = 0; i < NX_G2D_IMPORT_SLOTS; i++) {
+		struct nx_g2d_import *e = &ctx->dev->imports[i];
+
+		if (e->refs || (imp && e->used > imp->used))
+			continue;
+
+		/* the other contexts are not synced from this thread */
+		if (nx_g2d_handle_busy_others(ctx, e->handle))
+			continue;
+
+		imp = e;
+	}
+
+	return imp;
+}
+
+/* cached import of an inode, or of a handle for inode 0 */
+static struct nx_g2d_import *
+import_lookup(struct nx_g2d_dev *dev, ino_t inode, unsigned int handle)
+{
+	int i;
+
+	for (i = 0; i < NX_G2D_IMPORT_SLOTS; i++) {
+		struct nx_g2d_import *e = &dev->imports[i];
+
+		if (e->used && e->inode == inode &&
+		    (inode || e->handle == handle))
+			return e;
+	}
+
+	return NULL;
+}
+
+drm_public
+int nexell_g2d_import(struct nx_g2d_ctx *ctx, int fd, unsigned int owned,
+		      unsigned int *handle)
+{
+	struct nx_g2d_dev *dev = ctx->dev;
+	struct nx_g2d_import *imp;
+	struct nx_g2d_import new = { 0 };
+	struct stat st;
+	int i, ret = 0;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	new.inode = import_inode(fd, &st);
+	if (!new.inode && dev->sw) {
+		D_ERROR("%s() dma-buf fd %d has no inode of its own\n",
+			__func__, fd);
+		return -ENOTSUP;
+	}
+
+	pthread_mutex_lock(&dev->import_lock);
+
+	dev->import_tick++;
+
+	imp = new.inode ? import_lookup(dev, new.inode, 0) : NULL;
+	if (imp)
+		goto hit;
+
+	ret = import_buf(dev, fd, &new);
+	if (ret < 0)
+		goto out;
+
+	/* the caller's own handle, it closes it */
+	if (!dev->sw && new.handle == owned) {
+		*handle = owned;
+		goto out;
+	}
+
+	/* an import of a cached buffer returns its handle again */
+	imp = new.inode ? NULL : import_lookup(dev, 0, new.handle);
+	if (imp)
+		goto hit;
+
+	for (i = 0; i < NX_G2D_IMPORT_SLOTS && !imp; i++) {
+		if (!dev->imports[i].used)
+			imp = &dev->imports[i];
+	}
+
+	if (!imp) {
+		imp = import_victim(ctx);
+		if (!imp) {
+			D_ERROR("%s() all %d imports are in use\n",
+				__func__, NX_G2D_IMPORT_SLOTS);
+			ret = -EBUSY;
+			goto err;
+		}
+
+		/* queued commands of this context may still use it */
+		if (nx_g2d_handle_busy(ctx, imp->handle)) {
+			ret = nexell_g2d_sync(ctx);
+			if (ret < 0)
+				goto err;
+		}
+		import_release(dev, imp);
+	}
+
+	*imp = new;
+	imp->used = dev->import_tick;
+	imp->refs = 1;
+	*handle = imp->handle;
+
+	D_DEBUG("import dma-buf fd %d inode %lu handle 0x%x\n",
+		fd, (unsigned long)imp->inode, imp->handle);
+	goto out;
+
+hit:
+	imp->used = dev->import_tick;
+	imp->refs++;
+	*handle = imp->handle;
+	goto out;
+
+err:
+	import_release(dev, &new);
+out:
+	pthread_mutex_unlock(&dev->import_lock);
+
+	return ret;
+}
+
+drm_public
+void nexell_g2d_import_put(struct nx_g2d_ctx *ctx, unsigned int handle)
+{
+	struct nx_g2d_dev *dev = ctx->dev;
+	int i;
+
+	pthread_mutex_lock(&dev->import_lock);
+
+	for (i = 0; i < NX_G2D_IMPORT_SLOTS; i++) {
+		struct nx_g2d_import *e = &dev->imports[i];
+
+		if (e->used && e->handle == handle && e->refs) {
+			e->refs--;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&dev->import_lock);
+}
+
+void nx_g2d_import_release_all(struct nx_g2d_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < NX_G2D_IMPORT_SLOTS; i++) {
+		if (dev->imports[i].used)
+			import_release(dev, &dev->imports[i]);
+	}
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _NXP3220_G2D_PRIV_H_
+#define _NXP3220_G2D_PRIV_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "nexell_g2d.h"
+
+#define NX_G2D_BATCH_SIZE	64
+#define NX_G2D_TILE_CMDS	16	/* tiles submitted at once unbatched */
+#define NX_G2D_CPU_THRESHOLD	256	/* pixels */
+#define NX_G2D_HANDLE_SLOTS	16
+#define NX_G2D_MAX_SIZE		4096	/* 12-bit SIZE fields */
+#define NX_G2D_OVERLAP_MIN	16	/* smallest G2D overlap band or column */
+#define NX_G2D_LIST_SIZE	16	/* initial display list entries */
+#define NX_G2D_RING_SIZE	256
+#define NX_G2D_HYBRID_THREADS	4
+#define NX_G2D_HYBRID_PIXELS	(256 * 256)	/* smallest hybrid operation */
+#define NX_G2D_HYBRID_RATIO	512	/* initial G2D share, 1/1024 */
+#define NX_G2D_USER_HANDLE	~0U	/* user memory source of user_sw */
+#define NX_G2D_IMPORT_SLOTS	16	/* cached dma-buf imports */
+#define NX_G2D_SW_BUFS		64	/* software engine bindings */
+
+struct nx_g2d_sw;
+struct nx_g2d_capture;
+struct nx_g2d_ring;
+struct nx_g2d_pool;
+
+/* rows of a fill (src NULL) or same format copy done by a CPU worker */
+struct nx_g2d_band {
+	unsigned char *dst;
+	int dst_pitch;
+	const unsigned char *src;
+	int src_pitch;
+	int width, height;
+	int pixelbyte;
+	unsigned int pixel;
+};
+
+/* recorded commands, 'relocated' is the replay copy when relocating */
+struct nx_g2d_list {
+	struct nx_g2d_cmd *cmds;
+	int count;
+	int size;
+	struct nx_g2d_cmd *relocated;
+};
+
+/* cached dma-buf import, vaddr only mapped for the software engine */
+struct nx_g2d_import {
+	ino_t inode;
+	unsigned int handle;
+	__u64 used;			/* last use, 0 for a free slot */
+	int refs;			/* callers holding it, not released */
+	void *vaddr;
+	unsigned long size;
+};
+
+/* G2D device shared by the contexts of all threads */
+struct nx_g2d_dev {
+	int fd;
+	int major;
+	int minor;
+	int refcount;
+
+	/* software command engine, NULL for the hardware */
+	struct nx_g2d_sw *sw;
+	pthread_mutex_t sw_lock;
+
+	/* dma-buf imports, least recently used released first */
+	struct nx_g2d_import imports[NX_G2D_IMPORT_SLOTS];
+	__u64 import_tick;
+	pthread_mutex_t import_lock;
+
+	/* contexts created, numbers the contexts */
+	int contexts;
+
+	/* live contexts, their queued commands are checked by the imports */
+	struct nx_g2d_ctx *ctx_list;
+	pthread_mutex_t ctx_lock;
+};
+
+/* per thread context, only used by one thread at a time */
+struct nx_g2d_ctx {
+	struct nx_g2d_dev *dev;
+	struct nx_g2d_cmd cmd;
+	int id;				/* order of creation on dev */
+	struct nx_g2d_ctx *next;	/* dev->ctx_list */
+
+	/* submission thread, NULL when submitting from the caller */
+	struct nx_g2d_ring *ring;
+
+	/* command batch */
+	struct nx_g2d_cmd *batch;
+	int batch_size;
+	int batch_count;
+	unsigned int batch_flags;
+	bool batching;
+
+	/* serial of the last queued command and of the last retired one */
+	__u64 serial;
+	__u64 serial_done;
+
+	/*
+	 * last serial that used a buffer handle, hashed by handle.
+	 * serials of replaced slots are kept in serial_evicted so that
+	 * a handle without slot is never taken for idle too early.
+	 * Also read by the imports of other threads, see g2d_handle_touch().
+	 */
+	struct {
+		unsigned int handle;
+		__u64 serial;
+	} handles[NX_G2D_HANDLE_SLOTS];
+	__u64 serial_evicted;
+
+	/* largest fill and copy in pixels done by the CPU kernels */
+	int cpu_fill_threshold;
+	int cpu_copy_threshold;
+
+	/* display list being recorded, NULL if not recording */
+	struct nx_g2d_list *list;
+
+	/*
+	 * hybrid execution: CPU workers, G2D share of the rows in 1/1024
+	 * and the operation size from which a rectangle is split
+	 */
+	struct nx_g2d_pool *pool;
+	int hybrid_ratio;
+	int hybrid_pixels;
+
+	/* CPU renderer of the blits from user memory, created on first use */
+	struct nx_g2d_sw *user_sw;
+
+	/* command capture, NULL if not capturing */
+	struct nx_g2d_capture *capture;
+
+#ifdef NX_G2D_STATS
+	/*
+	 * submit_ns is the first submission since the engine was last
+	 * idle, 0 if idle. Commands and ioctls are also counted from the
+	 * submission thread, atomically and out of 'stats'.
+	 */
+	struct nx_g2d_stats stats;
+	__u64 stats_commands;
+	__u64 stats_ioctls;
+	__u64 stats_submit_ns;
+	__u64 stats_dump_ns;
+	__u64 stats_interval_ns;
+	char *stats_path;
+#endif
+};
+
+#ifdef NX_G2D_STATS
+#define G2D_STAT_TIME()			nx_g2d_time_ns()
+#define G2D_STAT_ADD(ctx, field, n)	((ctx)->stats.field += (n))
+#define G2D_STAT_ADD_ATOMIC(ctx, field, n)	\
+	__atomic_add_fetch(&(ctx)->stats_##field, (n), __ATOMIC_RELAXED)
+#else
+#define G2D_STAT_TIME()				0
+#define G2D_STAT_ADD(ctx, field, n)		do { } while (0)
+#define G2D_STAT_ADD_ATOMIC(ctx, field, n)	do { } while (0)
+#endif
+
+/* extract a register field, the reverse of BITS() */
+#define FIELD(v, n, s)	((((unsigned int)(v)) >> (s)) & ((1U << (n)) - 1))
+
+/* runs commands on the engine, also from the submission thread */
+int nx_g2d_exec(struct nx_g2d_ctx *ctx, struct nx_g2d_cmd *cmds, int count);
+
+/*
+ * true if a queued command of the context may still use the handle,
+ * also safe on the context of another thread
+ */
+bool nx_g2d_handle_busy(struct nx_g2d_ctx *ctx, unsigned int handle);
+
+/* the same for the other contexts of the device */
+bool nx_g2d_handle_busy_others(struct nx_g2d_ctx *ctx, unsigned int handle);
+
+/* dma-buf import cache */
+void nx_g2d_import_release_all(struct nx_g2d_dev *dev);
+
+/* statistics, no-ops when compiled out */
+#ifdef NX_G2D_STATS
+void nx_g2d_stats_init(struct nx_g2d_ctx *ctx);
+void nx_g2d_stats_free(struct nx_g2d_ctx *ctx);
+void nx_g2d_stats_submit(struct nx_g2d_ctx *ctx);
+void nx_g2d_stats_retired(struct nx_g2d_ctx *ctx);
+void nx_g2d_stats_sync(struct nx_g2d_ctx *ctx, __u64 start);
+#else
+#define nx_g2d_stats_init(ctx)		do { } while (0)
+#define nx_g2d_stats_free(ctx)		do { } while (0)
+#define nx_g2d_stats_submit(ctx)	do { } while (0)
+#define nx_g2d_stats_retired(ctx)	do { } while (0)
+#define nx_g2d_stats_sync(ctx, start)	do { (void)(start); } while (0)
+#endif
+
+/*
+ * Trace records, written to a ring per thread while NEXELL_G2D_TRACE is
+ * set. 'ts' is the start and 'dur' is filled in when added.
+ *	FILL, BLIT : serial of the last command queued, 0 if none
+ *	SUBMIT	   : last serial handed over, 'x' commands
+ *	EXEC	   : last serial run by the submission thread, 'x' commands
+ *	SYNC	   : last serial retired
+ */
+enum nx_g2d_trace_type {
+	NX_G2D_TRACE_FILL,
+	NX_G2D_TRACE_BLIT,
+	NX_G2D_TRACE_SUBMIT,
+	NX_G2D_TRACE_EXEC,
+	NX_G2D_TRACE_SYNC,
+};
+
+struct nx_g2d_trace_rec {
+	__u64 ts;			/* nx_g2d_time_ns() */
+	__u64 serial;
+	__u32 type;
+	__u32 dur;			/* ns */
+	__u32 ctx;			/* context id */
+	__u32 src, dst;			/* handles */
+	__s32 x, y, w, h;
+};
+
+/* records per thread ring, 0 with tracing off */
+extern unsigned int nx_g2d_trace_size;
+
+void nx_g2d_trace_add(const struct nx_g2d_trace_rec *rec);
+
+#define G2D_TRACE_TIME()	(nx_g2d_trace_size ? nx_g2d_time_ns() : 0)
+
+/* G2D_TRACE(.type = ..., .ts = start, ...) */
+#define G2D_TRACE(fields...) do { \
+		if (nx_g2d_trace_size) { \
+			struct nx_g2d_trace_rec __rec = { fields }; \
+			nx_g2d_trace_add(&__rec); \
+		} \
+	} while (0)
+
+/*
+ * Begin/end markers of the kernel trace_marker (or of a file) while
+ * NEXELL_G2D_TRACE_MARKER is set, only formatted when enabled.
+ */
+extern int nx_g2d_marker_fd;
+
+void nx_g2d_marker_begin(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+void nx_g2d_marker_end(void);
+
+#define G2D_MARKER_BEGIN(args...) do { \
+		if (nx_g2d_marker_fd >= 0) \
+			nx_g2d_marker_begin(args); \
+	} while (0)
+
+#define G2D_MARKER_END() do { \
+		if (nx_g2d_marker_fd >= 0) \
+			nx_g2d_marker_end(); \
+	} while (0)
+
+/*
+ * Command capture file, NEXELL_G2D_CAPTURE: a header followed by
+ * records, each followed by 'count' commands for SUBMIT.
+ *	BUFFER : 'count' is a handle and 'arg' the size used so far,
+ *		 written before the first command using more
+ *	SUBMIT : 'count' commands, 'arg' the serial of the first one
+ *	SYNC   : 'arg' the last serial retired
+ * 'ts' is in ns from the start of the capture. nexell_g2d_replay runs
+ * the captures again.
+ */
+#define NX_G2D_CAPTURE_MAGIC	0x5043584e	/* "NXCP" */
+#define NX_G2D_CAPTURE_VERSION	1
+
+enum nx_g2d_capture_type {
+	NX_G2D_CAPTURE_BUFFER,
+	NX_G2D_CAPTURE_SUBMIT,
+	NX_G2D_CAPTURE_SYNC,
+};
+
+struct nx_g2d_capture_hdr {
+	__u32 magic;
+	__u32 version;
+	__u32 cmd_size;			/* sizeof(struct nx_g2d_cmd) */
+	__u32 sw;			/* captured on the software engine */
+};
+
+struct nx_g2d_capture_rec {
+	__u32 type;
+	__u32 count;
+	__u64 ts;
+	__u64 arg;
+};
+
+void nx_g2d_capture_init(struct nx_g2d_ctx *ctx);
+void nx_g2d_capture_free(struct nx_g2d_ctx *ctx);
+void nx_g2d_capture_submit(struct nx_g2d_ctx *ctx,
+			   const struct nx_g2d_cmd *cmds, int count);
+void nx_g2d_capture_sync(struct nx_g2d_ctx *ctx, __u64 serial);
+
+/* submission ring */
+struct nx_g2d_ring *nx_g2d_ring_create(struct nx_g2d_ctx *ctx, int size);
+void nx_g2d_ring_destroy(struct nx_g2d_ring *ring);
+int nx_g2d_ring_push(struct nx_g2d_ring *ring,
+		     struct nx_g2d_cmd *cmds, int count);
+int nx_g2d_ring_drain(struct nx_g2d_ring *ring);
+
+/* hybrid CPU worker pool */
+__u64 nx_g2d_time_ns(void);
+struct nx_g2d_pool *nx_g2d_pool_create(int threads);
+void nx_g2d_pool_destroy(struct nx_g2d_pool *pool);
+int nx_g2d_pool_threads(struct nx_g2d_pool *pool);
+void nx_g2d_pool_run(struct nx_g2d_pool *pool,
+		     const struct nx_g2d_band *bands, int num);
+__u64 nx_g2d_pool_wait(struct nx_g2d_pool *pool);
+
+/* software command engine */
+struct nx_g2d_sw *nx_g2d_sw_create(void);
+void nx_g2d_sw_destroy(struct nx_g2d_sw *sw);
+int nx_g2d_sw_bind(struct nx_g2d_sw *sw, unsigned int handle,
+		   void *addr, unsigned long size);
+void nx_g2d_sw_unbind(struct nx_g2d_sw *sw, unsigned int handle);
+int nx_g2d_sw_exec(struct nx_g2d_sw *sw, struct nx_g2d_cmd *cmd);
+unsigned long nx_g2d_sw_area_end(const struct nx_g2d_cmd *cmd, bool src);
+unsigned int nx_g2d_sw_color(int pixelformat, int pixelorder,
+			     unsigned int argb);
+
+/* CPU kernels */
+void nx_g2d_cpu_fill(unsigned char *dst, int pitch, int width, int height,
+		     int pixelbyte, unsigned int pixel);
+void nx_g2d_cpu_copy(unsigned char *dst, int dst_pitch,
+		     const unsigned char *src, int src_pitch,
+		     int linesize, int height);
+
+#endif /* _NXP3220_G2D_PRIV_H_ */
@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Replays a command capture (NEXELL_G2D_CAPTURE) on the G2D or on the
+ * software engine and reports the throughput, for comparing driver
+ * releases on the same workload.
+ *
+ *	nexell_g2d_replay [-s] [-d device] [-n loops] [-o] [-c] capture
+ *	-s : software engine, the CPU reference
+ *	-o : also time each command alone, by kind
+ *	-c : print a checksum of each buffer after the first loop
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+#define REPLAY_DEVICE	"/dev/dri/card0"
+#define REPLAY_BUFS	256
+
+enum {
+	REPLAY_FILL,
+	REPLAY_COPY,
+	REPLAY_BLEND,
+	REPLAY_KINDS,
+};
+
+static const char * const replay_kinds[] = { "fill", "copy", "blend" };
+
+struct replay_buf {
+	unsigned int handle;		/* captured */
+	unsigned int new_handle;	/* replayed on */
+	unsigned long size;
+	void *vaddr;
+	unsigned long map_size;
+};
+
+struct replay_op {
+	__u32 type;
+	int count;
+	struct nx_g2d_cmd *cmds;
+};
+
+struct replay {
+	struct nx_g2d_ctx *ctx;
+	int fd;
+	bool sw;
+
+	struct replay_op *ops;
+	int num_ops;
+	struct replay_buf bufs[REPLAY_BUFS];
+	int num_bufs;
+
+	__u64 commands, pixels, syncs;
+};
+
+struct replay_time {
+	__u64 count, total, min, max;
+};
+
+static struct replay_buf *
+replay_buf(struct replay *rp, unsigned int handle, bool create)
+{
+	int i;
+
+	for (i = 0; i < rp->num_bufs; i++) {
+		if (rp->bufs[i].handle == handle)
+			return &rp->bufs[i];
+	}
+
+	if (!create || rp->num_bufs == REPLAY_BUFS)
+		return NULL;
+
+	rp->bufs[rp->num_bufs].handle = handle;
+
+	return &rp->bufs[rp->num_bufs++];
+}
+
+static int
+replay_load(struct replay *rp, const char *path)
+{
+	struct nx_g2d_capture_hdr hdr;
+	struct nx_g2d_capture_rec rec;
+	struct replay_op *op;
+	struct replay_buf *buf;
+	int size = 0, ret = -EINVAL;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != NX_G2D_CAPTURE_MAGIC) {
+		fprintf(stderr, "%s: not a capture\n", path);
+		goto out;
+	}
+
+	if (hdr.version != NX_G2D_CAPTURE_VERSION ||
+	    hdr.cmd_size != sizeof(struct nx_g2d_cmd)) {
+		fprintf(stderr, "%s: capture version %u, command size %u\n",
+			path, hdr.version, hdr.cmd_size);
+		goto out;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if (rec.type == NX_G2D_CAPTURE_BUFFER) {
+			buf = replay_buf(rp, rec.count, true);
+			if (!buf) {
+				fprintf(stderr, "more than %d buffers\n",
+					REPLAY_BUFS);
+				goto out;
+			}
+			if (buf->size < rec.arg)
+				buf->size = rec.arg;
+			continue;
+		}
+
+		if (rp->num_ops == size) {
+			size = size ? size * 2 : 1024;
+			op = realloc(rp->ops, size * sizeof(*op));
+			if (!op) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			rp->ops = op;
+		}
+
+		op = &rp->ops[rp->num_ops++];
+		op->type = rec.type;
+		op->count = 0;
+		op->cmds = NULL;
+
+		if (rec.type != NX_G2D_CAPTURE_SUBMIT)
+			continue;
+
+		op->cmds = malloc(rec.count * sizeof(*op->cmds));
+		if (!op->cmds) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (fread(op->cmds, sizeof(*op->cmds), rec.count, fp) !=
+		    rec.count) {
+			fprintf(stderr, "%s: truncated\n", path);
+			free(op->cmds);
+			op->cmds = NULL;
+			break;
+		}
+		op->count = rec.count;
+	}
+
+	printf("capture %s: %d records, %d buffers, %s engine\n",
+	       path, rp->num_ops, rp->num_bufs, hdr.sw ? "software" : "G2D");
+	ret = 0;
+
+out:
+	fclose(fp);
+
+	return ret;
+}
+
+static int
+replay_buf_alloc(struct replay *rp, struct replay_buf *buf)
+{
+	struct drm_mode_create_dumb create = { 0 };
+	struct drm_mode_map_dumb map = { 0 };
+	int ret;
+
+	if (rp->sw) {
+		buf->vaddr = calloc(1, buf->size);
+		if (!buf->vaddr)
+			return -ENOMEM;
+		buf->map_size = buf->size;
+		buf->new_handle = buf->handle;
+
+		return nexell_g2d_bind(rp->ctx, buf->handle, buf->vaddr,
+				       buf->size);
+	}
+
+	/* rows of 4096 bytes */
+	create.width = 1024;
+	create.height = (buf->size + 4095) / 4096;
+	create.bpp = 32;
+
+	ret = drmIoctl(rp->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
+	if (ret < 0) {
+		fprintf(stderr, "cannot allocate %lu bytes\n", buf->size);
+		return ret;
+	}
+	buf->new_handle = create.handle;
+
+	map.handle = create.handle;
+	ret = drmIoctl(rp->fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
+	if (ret < 0)
+		return ret;
+
+	buf->vaddr = mmap(NULL, create.size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, rp->fd, map.offset);
+	if (buf->vaddr == MAP_FAILED) {
+		buf->vaddr = NULL;
+		return -errno;
+	}
+	buf->map_size = create.size;
+
+	return 0;
+}
+
+static void
+replay_buf_free(struct replay *rp, struct replay_buf *buf)
+{
+	struct drm_mode_destroy_dumb destroy = { 0 };
+
+	if (rp->sw) {
+		nexell_g2d_unbind(rp->ctx, buf->handle);
+		free(buf->vaddr);
+		return;
+	}
+
+	if (buf->vaddr)
+		munmap(buf->vaddr, buf->map_size);
+
+	if (buf->new_handle) {
+		destroy.handle = buf->new_handle;
+		drmIoctl(rp->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+	}
+}
+
+/* replaces the captured handles with the allocated ones */
+static int
+replay_relocate(struct replay *rp)
+{
+	struct replay_buf *buf;
+	int i, j;
+
+	for (i = 0; i < rp->num_ops; i++) {
+		for (j = 0; j < rp->ops[i].count; j++) {
+			struct nx_g2d_cmd *cmd = &rp->ops[i].cmds[j];
+
+			buf = replay_buf(rp, cmd->dst.handle, false);
+			if (!buf && nx_g2d_sw_area_end(cmd, false)) {
+				fprintf(stderr, "no size of handle %u\n",
+					cmd->dst.handle);
+				return -EINVAL;
+			}
+			if (buf)
+				cmd->dst.handle = buf->new_handle;
+
+			buf = replay_buf(rp, cmd->src.handle, false);
+			if (!buf && nx_g2d_sw_area_end(cmd, true)) {
+				fprintf(stderr, "no size of handle %u\n",
+					cmd->src.handle);
+				return -EINVAL;
+			}
+			if (buf)
+				cmd->src.handle = buf->new_handle;
+		}
+	}
+
+	return 0;
+}
+
+static int
+replay_kind(const struct nx_g2d_cmd *cmd)
+{
+	unsigned int blend = cmd->cmd[NX_G2D_CMD_BLEND_EQUAT_ALPHA];
+
+	if (FIELD(blend, 1, 22) || FIELD(blend, 1, 27))	/* BLEND, ROP */
+		return REPLAY_BLEND;
+
+	if (FIELD(cmd->cmd[NX_G2D_CMD_SRC_CTRL], 1, 17))	/* SOLID_ENB */
+		return REPLAY_FILL;
+
+	return REPLAY_COPY;
+}
+
+static __u64
+replay_pixels(const struct nx_g2d_cmd *cmd)
+{
+	unsigned int size = cmd->cmd[NX_G2D_CMD_SIZE];
+
+	return (__u64)(FIELD(size, 12, 0) + 1) * (FIELD(size, 12, 16) + 1);
+}
+
+/* the captured stream, submissions and syncs as recorded */
+static int
+replay_run(struct replay *rp)
+{
+	int i, j, ret = 0;
+
+	for (i = 0; i < rp->num_ops && ret >= 0; i++) {
+		struct replay_op *op = &rp->ops[i];
+
+		if (op->type == NX_G2D_CAPTURE_SYNC) {
+			ret = nexell_g2d_sync(rp->ctx);
+			rp->syncs++;
+			continue;
+		}
+
+		if (!op->count)
+			continue;
+
+		ret = nx_g2d_exec(rp->ctx, op->cmds, op->count);
+
+		rp->commands += op->count;
+		for (j = 0; j < op->count; j++)
+			rp->pixels += replay_pixels(&op->cmds[j]);
+	}
+
+	if (ret >= 0)
+		ret = nexell_g2d_sync(rp->ctx);
+
+	return ret;
+}
+
+/* each command alone to the engine being idle */
+static int
+replay_ops(struct replay *rp, struct replay_time *times)
+{
+	int i, j, ret;
+
+	for (i = 0; i < rp->num_ops; i++) {
+		for (j = 0; j < rp->ops[i].count; j++) {
+			struct nx_g2d_cmd *cmd = &rp->ops[i].cmds[j];
+			struct replay_time *t = &times[replay_kind(cmd)];
+			__u64 start = nx_g2d_time_ns(), ns;
+
+			ret = nx_g2d_exec(rp->ctx, cmd, 1);
+			if (ret >= 0)
+				ret = nexell_g2d_sync(rp->ctx);
+			if (ret < 0)
+				return ret;
+
+			ns = nx_g2d_time_ns() - start;
+			if (!t->count || ns < t->min)
+				t->min = ns;
+			if (ns > t->max)
+				t->max = ns;
+			t->total += ns;
+			t->count++;
+		}
+	}
+
+	return 0;
+}
+
+/* FNV-1a of the buffers, to compare the G2D with the CPU reference */
+static void
+replay_checksum(struct replay *rp)
+{
+	int i;
+
+	for (i = 0; i < rp->num_bufs; i++) {
+		const unsigned char *p = rp->bufs[i].vaddr;
+		__u32 hash = 2166136261U;
+		unsigned long n;
+
+		for (n = 0; n < rp->bufs[i].size; n++)
+			hash = (hash ^ p[n]) * 16777619U;
+
+		printf("buffer %u: %lu bytes, checksum %08x\n",
+		       rp->bufs[i].handle, rp->bufs[i].size, hash);
+	}
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-s] [-d device] [-n loops] [-o] [-c] capture\n"
+		"  -s  run on the software engine (CPU reference)\n"
+		"  -d  DRM device, default %s\n"
+		"  -n  times the capture is replayed, default 1\n"
+		"  -o  time each command alone, by kind\n"
+		"  -c  print the buffer checksums after the first loop\n",
+		name, REPLAY_DEVICE);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay rp = { .fd = -1 };
+	struct replay_time times[REPLAY_KINDS] = { { 0 } };
+	const char *device = REPLAY_DEVICE;
+	bool per_op = false, checksum = false;
+	int loops = 1, opt, i, ret;
+	__u64 start, ns;
+
+	while ((opt = getopt(argc, argv, "sd:n:och")) != -1) {
+		switch (opt) {
+		case 's':
+			rp.sw = true;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'o':
+			per_op = true;
+			break;
+		case 'c':
+			checksum = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1 || loops < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* the replay itself is not captured */
+	unsetenv("NEXELL_G2D_CAPTURE");
+
+	ret = replay_load(&rp, argv[optind]);
+	if (ret < 0)
+		goto out;
+
+	ret = -EINVAL;
+
+	if (rp.sw && rp.num_bufs > NX_G2D_SW_BUFS) {
+		fprintf(stderr, "%d buffers, the software engine binds %d\n",
+			rp.num_bufs, NX_G2D_SW_BUFS);
+		goto out;
+	}
+
+	if (!rp.sw) {
+		rp.fd = open(device, O_RDWR | O_CLOEXEC);
+		if (rp.fd < 0) {
+			fprintf(stderr, "cannot open %s: %s\n", device,
+				strerror(errno));
+			goto out;
+		}
+	}
+
+	rp.ctx = nexell_g2d_alloc_flags(rp.fd,
+			rp.sw ? NX_G2D_ALLOC_SOFTWARE : 0, NULL, NULL);
+	if (!rp.ctx) {
+		fprintf(stderr, "cannot create the G2D context\n");
+		goto out;
+	}
+
+	for (i = 0; i < rp.num_bufs; i++) {
+		ret = replay_buf_alloc(&rp, &rp.bufs[i]);
+		if (ret < 0)
+			goto out;
+	}
+
+	ret = replay_relocate(&rp);
+	if (ret < 0)
+		goto out;
+
+	start = nx_g2d_time_ns();
+
+	for (i = 0; i < loops; i++) {
+		ret = replay_run(&rp);
+		if (ret < 0) {
+			fprintf(stderr, "replay failed: %d\n", ret);
+			goto out;
+		}
+
+		if (!i && checksum)
+			replay_checksum(&rp);
+	}
+
+	ns = nx_g2d_time_ns() - start;
+
+	printf("%d loops: %llu commands, %llu syncs, %.3f ms\n", loops,
+	       (unsigned long long)rp.commands,
+	       (unsigned long long)rp.syncs, ns / 1e6);
+	printf("%.0f commands/s, %.2f Mpixels/s\n",
+	       rp.commands * 1e9 / (ns ? ns : 1),
+	       rp.pixels * 1e3 / (ns ? ns : 1));
+
+	if (per_op) {
+		ret = replay_ops(&rp, times);
+		if (ret < 0) {
+			fprintf(stderr, "replay failed: %d\n", ret);
+			goto out;
+		}
+
+		printf("%-6s %10s %10s %10s %10s\n",
+		       "kind", "count", "avg_us", "min_us", "max_us");
+		for (i = 0; i < REPLAY_KINDS; i++) {
+			if (!times[i].count)
+				continue;
+			printf("%-6s %10llu %10.1f %10.1f %10.1f\n",
+			       replay_kinds[i],
+			       (unsigned long long)times[i].count,
+			       times[i].total / 1e3 / times[i].count,
+			       times[i].min / 1e3, times[i].max / 1e3);
+		}
+	}
+
+out:
+	if (rp.ctx) {
+		for (i = 0; i < rp.num_bufs; i++)
+			replay_buf_free(&rp, &rp.bufs[i]);
+		nexell_g2d_free(rp.ctx);
+	}
+
+	for (i = 0; i < rp.num_ops; i++)
+		free(rp.ops[i].cmds);
+	free(rp.ops);
+
+	if (rp.fd >= 0)
+		close(rp.fd);
+
+	return ret < 0;
+}
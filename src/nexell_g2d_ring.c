@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * Submission ring
+ *
+ * Single producer (the rendering thread) and single consumer (the
+ * submission thread) ring of encoded commands. head is only written by
+ * the producer and tail only by the consumer, both published with
+ * release/acquire ordering so that a slot is never read before it is
+ * written or reused before it is submitted.
+ *
+ *	items	: one post per queued command, the consumer sleeps on it
+ *	space	: one post per free slot, the producer sleeps on it when full
+ *	lock	: only taken to wait for and signal an empty ring
+ *
+ * The consumer submits all contiguous queued commands at once, so a full
+ * batch still goes to the kernel with one list ioctl when available.
+ */
+
+struct nx_g2d_ring {
+	struct nx_g2d_ctx *ctx;
+	struct nx_g2d_cmd *cmds;
+	unsigned int size;		/* power of 2 */
+	unsigned int head;		/* producer */
+	unsigned int tail;		/* consumer */
+
+	sem_t items;
+	sem_t space;
+
+	pthread_mutex_t lock;
+	pthread_cond_t drained;
+
+	/* serial of the command before the first one queued */
+	__u64 serial;
+
+	pthread_t thread;
+	bool running;
+	bool stop;
+	int error;			/* first failed submission */
+};
+
+static void *
+ring_thread(void *data)
+{
+	struct nx_g2d_ring *ring = data;
+	unsigned int head, tail, count, i;
+	__u64 start;
+	int ret;
+
+	for (;;) {
+		sem_wait(&ring->items);
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+
+		if (head == tail) {
+			if (__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE))
+				break;
+			/* token of commands already submitted */
+			continue;
+		}
+
+		/* contiguous commands up to the end of the ring */
+		count = head - tail;
+		if (count > ring->size - (tail & (ring->size - 1)))
+			count = ring->size - (tail & (ring->size - 1));
+
+		start = G2D_TRACE_TIME();
+
+		ret = nx_g2d_exec(ring->ctx,
+				  &ring->cmds[tail & (ring->size - 1)], count);
+		if (ret < 0 && !ring->error)
+			ring->error = ret;
+
+		/* commands are queued in serial order */
+		G2D_TRACE(.type = NX_G2D_TRACE_EXEC, .ctx = ring->ctx->id,
+			  .ts = start, .serial = ring->serial + tail + count,
+			  .x = count);
+
+		pthread_mutex_lock(&ring->lock);
+		__atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+		if (tail + count == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+			pthread_cond_broadcast(&ring->drained);
+		pthread_mutex_unlock(&ring->lock);
+
+		for (i = 0; i < count; i++)
+			sem_post(&ring->space);
+	}
+
+	return NULL;
+}
+
+struct nx_g2d_ring *nx_g2d_ring_create(struct nx_g2d_ctx *ctx, int size)
+{
+	struct nx_g2d_ring *ring;
+	unsigned int n = 1;
+
+	while (n < (unsigned int)size)
+		n <<= 1;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->cmds = calloc(n, sizeof(*ring->cmds));
+	if (!ring->cmds) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->ctx = ctx;
+	ring->size = n;
+	ring->serial = ctx->serial - ctx->batch_count;
+
+	sem_init(&ring->items, 0, 0);
+	sem_init(&ring->space, 0, n);
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->drained, NULL);
+
+	if (pthread_create(&ring->thread, NULL, ring_thread, ring)) {
+		D_ERROR("%s() Failed to create the submission thread\n",
+			__func__);
+		nx_g2d_ring_destroy(ring);
+		return NULL;
+	}
+	ring->running = true;
+
+	D_DEBUG("submission ring %u\n", n);
+
+	return ring;
+}
+
+void nx_g2d_ring_destroy(struct nx_g2d_ring *ring)
+{
+	if (ring->running) {
+		nx_g2d_ring_drain(ring);
+
+		__atomic_store_n(&ring->stop, true, __ATOMIC_RELEASE);
+		sem_post(&ring->items);
+		pthread_join(ring->thread, NULL);
+	}
+
+	pthread_cond_destroy(&ring->drained);
+	pthread_mutex_destroy(&ring->lock);
+	sem_destroy(&ring->space);
+	sem_destroy(&ring->items);
+
+	free(ring->cmds);
+	free(ring);
+}
+
+int nx_g2d_ring_push(struct nx_g2d_ring *ring,
+		     struct nx_g2d_cmd *cmds, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		while (sem_wait(&ring->space) && errno == EINTR)
+			;
+
+		ring->cmds[ring->head & (ring->size - 1)] = cmds[i];
+		__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+		sem_post(&ring->items);
+	}
+
+	return 0;
+}
+
+/* waits until the thread has submitted every queued command */
+int nx_g2d_ring_drain(struct nx_g2d_ring *ring)
+{
+	int ret;
+
+	pthread_mutex_lock(&ring->lock);
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head)
+		pthread_cond_wait(&ring->drained, &ring->lock);
+	pthread_mutex_unlock(&ring->lock);
+
+	/* report a failed submission once */
+	ret = ring->error;
+	ring->error = 0;
+
+	return ret;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+#ifdef NX_G2D_STATS
+
+#define STATS_INTERVAL	1000	/* ms between dumps */
+
+static void
+stats_latency(__u64 *hist, __u64 ns)
+{
+	__u64 us = ns / 1000;
+	int n = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (n >= NX_G2D_STATS_BUCKETS)
+		n = NX_G2D_STATS_BUCKETS - 1;
+
+	hist[n]++;
+}
+
+static void
+stats_hist(FILE *fp, const char *name, const __u64 *hist)
+{
+	int i;
+
+	fprintf(fp, "%s", name);
+	for (i = 0; i < NX_G2D_STATS_BUCKETS; i++)
+		fprintf(fp, " %llu", (unsigned long long)hist[i]);
+	fprintf(fp, "\n");
+}
+
+static void
+stats_dump(struct nx_g2d_ctx *ctx)
+{
+	struct nx_g2d_stats stats;
+	FILE *fp;
+
+	nexell_g2d_get_stats(ctx, &stats);
+
+	fp = fopen(ctx->stats_path, "w");
+	if (!fp) {
+		D_DEBUG("cannot write statistics %s\n", ctx->stats_path);
+		return;
+	}
+
+	fprintf(fp, "fills %llu\n", (unsigned long long)stats.fills);
+	fprintf(fp, "blits %llu\n", (unsigned long long)stats.blits);
+	fprintf(fp, "pixels %llu\n", (unsigned long long)stats.pixels);
+	fprintf(fp, "bytes %llu\n", (unsigned long long)stats.bytes);
+	fprintf(fp, "cpu_ops %llu\n", (unsigned long long)stats.cpu_ops);
+	fprintf(fp, "hybrid_ops %llu\n",
+		(unsigned long long)stats.hybrid_ops);
+	fprintf(fp, "user_blits %llu\n",
+		(unsigned long long)stats.user_blits);
+	fprintf(fp, "commands %llu\n", (unsigned long long)stats.commands);
+	fprintf(fp, "ioctls %llu\n", (unsigned long long)stats.ioctls);
+	fprintf(fp, "syncs %llu\n", (unsigned long long)stats.syncs);
+	fprintf(fp, "fallbacks %llu\n", (unsigned long long)stats.fallbacks);
+	fprintf(fp, "overlap_tiles %llu\n",
+		(unsigned long long)stats.overlap_tiles);
+	stats_hist(fp, "submit_lat_us_log2", stats.submit_lat);
+	stats_hist(fp, "sync_lat_us_log2", stats.sync_lat);
+
+	fclose(fp);
+}
+
+void nx_g2d_stats_init(struct nx_g2d_ctx *ctx)
+{
+	const char *env = getenv("NEXELL_G2D_STATS");
+	int interval = STATS_INTERVAL;
+
+	if (!env || !*env)
+		return;
+
+	ctx->stats_path = malloc(strlen(env) + 16);
+	if (!ctx->stats_path)
+		return;
+
+	if (ctx->id)
+		sprintf(ctx->stats_path, "%s.%d", env, ctx->id);
+	else
+		strcpy(ctx->stats_path, env);
+
+	env = getenv("NEXELL_G2D_STATS_INTERVAL");
+	if (env && *env)
+		interval = atoi(env);
+
+	ctx->stats_interval_ns = (__u64)interval * 1000000;
+	ctx->stats_dump_ns = nx_g2d_time_ns();
+}
+
+void nx_g2d_stats_free(struct nx_g2d_ctx *ctx)
+{
+	if (!ctx->stats_path)
+		return;
+
+	stats_dump(ctx);
+	free(ctx->stats_path);
+}
+
+void nx_g2d_stats_submit(struct nx_g2d_ctx *ctx)
+{
+	if (!ctx->stats_submit_ns)
+		ctx->stats_submit_ns = nx_g2d_time_ns();
+}
+
+void nx_g2d_stats_retired(struct nx_g2d_ctx *ctx)
+{
+	if (!ctx->stats_submit_ns)
+		return;
+
+	stats_latency(ctx->stats.submit_lat,
+		      nx_g2d_time_ns() - ctx->stats_submit_ns);
+	ctx->stats_submit_ns = 0;
+}
+
+void nx_g2d_stats_sync(struct nx_g2d_ctx *ctx, __u64 start)
+{
+	__u64 now = nx_g2d_time_ns();
+
+	ctx->stats.syncs++;
+	stats_latency(ctx->stats.sync_lat, now - start);
+
+	nx_g2d_stats_retired(ctx);
+
+	if (ctx->stats_path && now - ctx->stats_dump_ns >=
+	    ctx->stats_interval_ns) {
+		ctx->stats_dump_ns = now;
+		stats_dump(ctx);
+	}
+}
+
+drm_public
+int nexell_g2d_get_stats(struct nx_g2d_ctx *ctx, struct nx_g2d_stats *stats)
+{
+	*stats = ctx->stats;
+
+	/* also counted by the submission thread */
+	stats->commands = __atomic_load_n(&ctx->stats_commands,
+					  __ATOMIC_RELAXED);
+	stats->ioctls = __atomic_load_n(&ctx->stats_ioctls, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+drm_public
+void nexell_g2d_stats_fallback(struct nx_g2d_ctx *ctx)
+{
+	ctx->stats.fallbacks++;
+}
+
+#else
+
+drm_public
+int nexell_g2d_get_stats(struct nx_g2d_ctx *ctx __attribute__((unused)),
+			 struct nx_g2d_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	return -ENOSYS;
+}
+
+drm_public
+void nexell_g2d_stats_fallback(struct nx_g2d_ctx *ctx __attribute__((unused)))
+{
+}
+
+#endif /* NX_G2D_STATS */
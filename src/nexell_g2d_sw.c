@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * Software G2D engine
+ *
+ * Decodes struct nx_g2d_cmd register words the same way the NXP3220 G2D
+ * does and renders into CPU mapped buffers bound per buffer handle.
+ * It is used as a backend where no G2D exists and as a pixel reference
+ * for the hardware output.
+ *
+ * Pixel pipeline per destination pixel:
+ *	source	: SOLID_COLOR (SOLID_ENB), source buffer (SRC_RD_ENB) or 0,
+ *		  alpha replaced with SRC_FORCE_ALPHA when enabled
+ *	dest	: destination buffer when DST_RD_ENB, otherwise 0
+ *	result	: ROP (ROP_ENB), blend equation (BLEND_ENB) or source,
+ *		  written through WRITE_MASK and DITHER to the dst format
+ */
+
+struct nx_g2d_sw_buf {
+	unsigned int handle;
+	unsigned char *addr;
+	unsigned long size;
+};
+
+struct nx_g2d_sw {
+	struct nx_g2d_sw_buf bufs[NX_G2D_SW_BUFS];
+};
+
+/* component bits and position, in A, R, G, B order */
+struct sw_format {
+	int bits[4];
+	int shift[4];
+	int pixelbyte;
+	bool alpha;
+	bool valid;
+};
+
+/* A, R, G, B (or X, R, G, B) component widths of each color format */
+static const struct {
+	int bits[4];
+	int pixelbyte;
+	bool alpha;
+} sw_color_fmts[16] = {
+	[NX_G2D_PIXEL_FMT_RGB565] = { { 0, 5, 6, 5 }, 2, false },
+	[NX_G2D_PIXEL_FMT_XRGB1555] = { { 1, 5, 5, 5 }, 2, false },
+	[NX_G2D_PIXEL_FMT_ARGB1555] = { { 1, 5, 5, 5 }, 2, true },
+	[NX_G2D_PIXEL_FMT_XRGB4444] = { { 4, 4, 4, 4 }, 2, false },
+	[NX_G2D_PIXEL_FMT_ARGB4444] = { { 4, 4, 4, 4 }, 2, true },
+	[NX_G2D_PIXEL_FMT_RGB888] = { { 0, 8, 8, 8 }, 3, false },
+	[NX_G2D_PIXEL_FMT_XRGB8888] = { { 8, 8, 8, 8 }, 4, false },
+	[NX_G2D_PIXEL_FMT_ARGB8888] = { { 8, 8, 8, 8 }, 4, true },
+};
+
+/* component index (A:0, R:1, G:2, B:3) from MSB to LSB for each order */
+static const int sw_color_orders[4][4] = {
+	[NX_G2D_PIXEL_ORDER_ARGB] = { 0, 1, 2, 3 },
+	[NX_G2D_PIXEL_ORDER_RGBA] = { 1, 2, 3, 0 },
+	[NX_G2D_PIXEL_ORDER_ABGR] = { 0, 3, 2, 1 },
+	[NX_G2D_PIXEL_ORDER_BGRA] = { 3, 2, 1, 0 },
+};
+
+/* 4x4 ordered dither matrix, 0..15 */
+static const int sw_dither[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+static void
+sw_format_decode(struct sw_format *f, unsigned int ctrl)
+{
+	int fmt = FIELD(ctrl, 4, 0);
+	int order = FIELD(ctrl, 2, 4);
+	int i, c, shift = 0;
+
+	memset(f, 0, sizeof(*f));
+
+	if (!sw_color_fmts[fmt].pixelbyte)
+		return;
+
+	f->pixelbyte = sw_color_fmts[fmt].pixelbyte;
+	f->alpha = sw_color_fmts[fmt].alpha;
+
+	/* walk the components from LSB to MSB */
+	for (i = 3; i >= 0; i--) {
+		c = sw_color_orders[order][i];
+		f->bits[c] = sw_color_fmts[fmt].bits[c];
+		f->shift[c] = shift;
+		shift += f->bits[c];
+	}
+
+	f->valid = true;
+}
+
+static inline unsigned int
+sw_read_raw(const unsigned char *p, int pixelbyte)
+{
+	switch (pixelbyte) {
+	case 2:
+		return p[0] | (p[1] << 8);
+	case 3:
+		return p[0] | (p[1] << 8) | (p[2] << 16);
+	default:
+		return p[0] | (p[1] << 8) | (p[2] << 16) |
+			((unsigned int)p[3] << 24);
+	}
+}
+
+static inline void
+sw_write_raw(unsigned char *p, int pixelbyte, unsigned int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	if (pixelbyte > 2)
+		p[2] = v >> 16;
+	if (pixelbyte > 3)
+		p[3] = v >> 24;
+}
+
+/* expand n bits to 8 bits by bit replication */
+static inline int
+sw_expand(unsigned int v, int bits)
+{
+	switch (bits) {
+	case 1:
+		return v ? 0xff : 0;
+	case 4:
+		return (v << 4) | v;
+	case 5:
+		return (v << 3) | (v >> 2);
+	case 6:
+		return (v << 2) | (v >> 4);
+	default:
+		return v;
+	}
+}
+
+static inline void
+sw_unpack(const struct sw_format *f, unsigned int raw, int c[4])
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		c[i] = f->bits[i] ?
+			sw_expand(FIELD(raw, f->bits[i], f->shift[i]),
+				  f->bits[i]) : 0xff;
+
+	if (!f->alpha)
+		c[0] = 0xff;
+}
+
+static inline unsigned int
+sw_pack(const struct sw_format *f, const int c[4], int dither)
+{
+	unsigned int raw = 0;
+	int i, v;
+
+	for (i = 0; i < 4; i++) {
+		if (!f->bits[i])
+			continue;
+
+		v = c[i];
+		if (!f->alpha && !i)
+			v = 0xff;
+
+		/* ordered dither of the dropped precision */
+		if (dither >= 0 && f->bits[i] < 8)
+			v = (v * ((1 << f->bits[i]) - 1) + dither * 16) / 0xff;
+		else
+			v >>= 8 - f->bits[i];
+
+		raw |= (unsigned int)v << f->shift[i];
+	}
+
+	return raw;
+}
+
+static inline int
+sw_mul(int a, int b)
+{
+	int t = a * b + 0x80;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline int
+sw_clamp(int v)
+{
+	return v < 0 ? 0 : v > 0xff ? 0xff : v;
+}
+
+/* blend factor for component i (A:0, R:1, G:2, B:3) */
+static int
+sw_factor(int func, int i, const int s[4], const int d[4], const int k[4])
+{
+	switch (func) {
+	case GL_BLEND_ZERO:
+		return 0;
+	case GL_BLEND_ONE:
+		return 0xff;
+	case GL_BLEND_SRC_COLOR:
+		return s[i];
+	case GL_BLEND_ONE_MINUS_SRC_COLOR:
+		return 0xff - s[i];
+	case GL_BLEND_DST_COLOR:
+		return d[i];
+	case GL_BLEND_ONE_MINUS_DST_COLOR:
+		return 0xff - d[i];
+	case GL_BLEND_SRC_ALPHA:
+		return s[0];
+	case GL_BLEND_ONE_MINUS_SRC_ALPHA:
+		return 0xff - s[0];
+	case GL_BLEND_DST_ALPHA:
+		return d[0];
+	case GL_BLEND_ONE_MINUS_DST_ALPHA:
+		return 0xff - d[0];
+	case GL_BLEND_CONSTANT_COLOR:
+		return k[i];
+	case GL_BLEND_ONE_MINUS_CONSTANT_COLOR:
+		return 0xff - k[i];
+	case GL_BLEND_CONSTANT_ALPHA:
+		return k[0];
+	case GL_BLEND_ONE_MINUS_CONSTANT_ALPHA:
+		return 0xff - k[0];
+	case GL_BLEND_SRC_ALPHA_SATURATE:
+		if (!i)
+			return 0xff;
+		return s[0] < 0xff - d[0] ? s[0] : 0xff - d[0];
+	default:
+		return 0;
+	}
+}
+
+static int
+sw_equation(int equat, int s, int d, int fs, int fd)
+{
+	switch (equat) {
+	case GL_EQUATION_FUNC_ADD:
+		return sw_clamp(sw_mul(s, fs) + sw_mul(d, fd));
+	case GL_EQUATION_FUNC_SUB:
+		return sw_clamp(sw_mul(s, fs) - sw_mul(d, fd));
+	case GL_EQUATION_FUNC_REVERSE_SUB:
+		return sw_clamp(sw_mul(d, fd) - sw_mul(s, fs));
+	case GL_EQUATION_FUNC_MIN:
+		return s < d ? s : d;
+	case GL_EQUATION_FUNC_MAX:
+		return s > d ? s : d;
+	case GL_EQUATION_FUNC_DARKEN:
+		s = sw_mul(s, fs);
+		d = sw_mul(d, fd);
+		return s < d ? s : d;
+	case GL_EQUATION_FUNC_LIGHTEN:
+		s = sw_mul(s, fs);
+		d = sw_mul(d, fd);
+		return s > d ? s : d;
+	case GL_EQUATION_FUNC_MULTIPLY:
+		return sw_mul(s, d);
+	default:
+		return s;
+	}
+}
+
+static int
+sw_rop(int rop, int s, int d)
+{
+	switch (rop) {
+	case GL_BLEND_ROP_CLEAR:
+		return 0;
+	case GL_BLEND_ROP_NOR:
+		return ~(s | d) & 0xff;
+	case GL_BLEND_ROP_AND_INVERTED:
+		return ~s & d & 0xff;
+	case GL_BLEND_ROP_COPY_INVERTED:
+		return ~s & 0xff;
+	case GL_BLEND_ROP_AND_REVERSE:
+		return s & ~d & 0xff;
+	case GL_BLEND_ROP_NOOP:
+		return d;
+	case GL_BLEND_ROP_XOR:
+		return s ^ d;
+	case GL_BLEND_ROP_NAND:
+		return ~(s & d) & 0xff;
+	case GL_BLEND_ROP_AND:
+		return s & d;
+	case GL_BLEND_ROP_EQUIV:
+		return ~(s ^ d) & 0xff;
+	case GL_BLEND_ROP_INVERT:
+		return ~d & 0xff;
+	case GL_BLEND_ROP_OR_INVERTED:
+		return (~s | d) & 0xff;
+	case GL_BLEND_ROP_COPY:
+		return s;
+	case GL_BLEND_ROP_OR_REVERSE:
+		return (s | ~d) & 0xff;
+	case GL_BLEND_ROP_OR:
+		return s | d;
+	default:
+		return 0xff;
+	}
+}
+
+static struct nx_g2d_sw_buf *
+sw_buf_find(struct nx_g2d_sw *sw, unsigned int handle)
+{
+	int i;
+
+	for (i = 0; i < NX_G2D_SW_BUFS; i++) {
+		if (sw->bufs[i].addr && sw->bufs[i].handle == handle)
+			return &sw->bufs[i];
+	}
+
+	return NULL;
+}
+
+/* returns the first line of the buffer area, NULL if out of range */
+static unsigned char *
+sw_buf_area(struct nx_g2d_sw *sw, struct nx_g2d_buf *buf,
+	    int stride, int linesize, int height)
+{
+	struct nx_g2d_sw_buf *b = sw_buf_find(sw, buf->handle);
+	unsigned long end;
+
+	if (!b) {
+		D_ERROR("%s() not bound handle:%u\n", __func__, buf->handle);
+		return NULL;
+	}
+
+	end = buf->offset + (unsigned long)stride * (height - 1) + linesize;
+	if (stride < linesize || end > b->size) {
+		D_ERROR("%s() handle:%u, offset:%u, stride:%d, %dx%d over %lu\n",
+			__func__, buf->handle, buf->offset, stride,
+			linesize, height, b->size);
+		return NULL;
+	}
+
+	return b->addr + buf->offset;
+}
+
+struct nx_g2d_sw *nx_g2d_sw_create(void)
+{
+	return calloc(1, sizeof(struct nx_g2d_sw));
+}
+
+void nx_g2d_sw_destroy(struct nx_g2d_sw *sw)
+{
+	free(sw);
+}
+
+int nx_g2d_sw_bind(struct nx_g2d_sw *sw, unsigned int handle,
+		   void *addr, unsigned long size)
+{
+	struct nx_g2d_sw_buf *b;
+	int i;
+
+	if (!addr)
+		return -EINVAL;
+
+	b = sw_buf_find(sw, handle);
+	if (!b) {
+		/*
+		 * a binding may still be used by queued commands or by the
+		 * caller, only nx_g2d_sw_unbind() frees one
+		 */
+		for (i = 0; i < NX_G2D_SW_BUFS; i++) {
+			if (!sw->bufs[i].addr) {
+				b = &sw->bufs[i];
+				break;
+			}
+		}
+
+		if (!b) {
+			D_ERROR("%s() no free binding for handle:%u\n",
+				__func__, handle);
+			return -ENOSPC;
+		}
+	}
+
+	b->handle = handle;
+	b->addr = addr;
+	b->size = size;
+
+	return 0;
+}
+
+void nx_g2d_sw_unbind(struct nx_g2d_sw *sw, unsigned int handle)
+{
+	struct nx_g2d_sw_buf *b = sw_buf_find(sw, handle);
+
+	if (b)
+		memset(b, 0, sizeof(*b));
+}
+
+int nx_g2d_sw_exec(struct nx_g2d_sw *sw, struct nx_g2d_cmd *cmd)
+{
+	unsigned int src_ctrl = cmd->cmd[NX_G2D_CMD_SRC_CTRL];
+	unsigned int dst_ctrl = cmd->cmd[NX_G2D_CMD_DST_CTRL];
+	unsigned int blend = cmd->cmd[NX_G2D_CMD_BLEND_EQUAT_ALPHA];
+	unsigned int size = cmd->cmd[NX_G2D_CMD_SIZE];
+	unsigned int solid = cmd->cmd[NX_G2D_CMD_SOLID_COLOR];
+	unsigned int bcolor = cmd->cmd[NX_G2D_CMD_BLEND_COLOR];
+	int width = FIELD(size, 12, 0) + 1;
+	int height = FIELD(size, 12, 16) + 1;
+	int src_stride = cmd->cmd[NX_G2D_CMD_SRC_STRIDE];
+	int dst_stride = cmd->cmd[NX_G2D_CMD_DST_STRIDE];
+	bool solid_enb = FIELD(src_ctrl, 1, 17);
+	bool src_rd = FIELD(src_ctrl, 1, 6) && !solid_enb;
+	bool force_alpha = FIELD(src_ctrl, 1, 16);
+	bool dst_rd = FIELD(dst_ctrl, 1, 6);
+	bool dither = FIELD(dst_ctrl, 1, 7);
+	bool blend_enb = FIELD(blend, 1, 22);
+	bool rop_enb = FIELD(blend, 1, 27);
+	int wmask = FIELD(blend, 4, 28);
+	int rop = FIELD(blend, 4, 23);
+	int fs_rgb = FIELD(blend, 4, 18), fd_rgb = FIELD(blend, 4, 14);
+	int fs_a = FIELD(blend, 4, 10), fd_a = FIELD(blend, 4, 6);
+	int eq_rgb = FIELD(blend, 3, 3), eq_a = FIELD(blend, 3, 0);
+	int dither_x = FIELD(dst_ctrl, 2, 10), dither_y = FIELD(dst_ctrl, 2, 8);
+	/* BLEND_COLOR is RGBA, SOLID_COLOR is ARGB */
+	int k[4] = { bcolor & 0xff, (bcolor >> 24) & 0xff,
+		     (bcolor >> 16) & 0xff, (bcolor >> 8) & 0xff };
+	int sc[4] = { (solid >> 24) & 0xff, (solid >> 16) & 0xff,
+		      (solid >> 8) & 0xff, solid & 0xff };
+	struct sw_format sf, df;
+	unsigned char *src = NULL, *dst;
+	int x, y, i;
+
+	if (FIELD(src_ctrl, 1, 18))	/* DISCARD */
+		return 0;
+
+	sw_format_decode(&df, dst_ctrl);
+	if (!df.valid) {
+		D_ERROR("%s() invalid destination format 0x%x\n",
+			__func__, dst_ctrl);
+		return -EINVAL;
+	}
+
+	dst = sw_buf_area(sw, &cmd->dst, dst_stride,
+			  width * df.pixelbyte, height);
+	if (!dst)
+		return -EINVAL;
+
+	if (src_rd) {
+		sw_format_decode(&sf, src_ctrl);
+		if (!sf.valid) {
+			D_ERROR("%s() invalid source format 0x%x\n",
+				__func__, src_ctrl);
+			return -EINVAL;
+		}
+
+		src = sw_buf_area(sw, &cmd->src, src_stride,
+				  width * sf.pixelbyte, height);
+		if (!src)
+			return -EINVAL;
+	}
+
+	if (force_alpha)
+		sc[0] = FIELD(src_ctrl, 8, 8);
+
+	/* plain copy and fill: no per component work */
+	if (!blend_enb && !rop_enb && wmask == 0xf && !dither &&
+	    !force_alpha &&
+	    (!src_rd || FIELD(src_ctrl, 6, 0) == FIELD(dst_ctrl, 6, 0))) {
+		int linesize = width * df.pixelbyte;
+
+		if (src_rd) {
+			for (y = 0; y < height; y++)
+				memmove(dst + y * dst_stride,
+					src + y * src_stride, linesize);
+			return 0;
+		}
+
+		{
+			unsigned int raw = sw_pack(&df, sc, -1);
+			unsigned char *p = dst;
+
+			for (x = 0; x < width; x++)
+				sw_write_raw(p + x * df.pixelbyte,
+					     df.pixelbyte, raw);
+			for (y = 1; y < height; y++)
+				memcpy(dst + y * dst_stride, dst, linesize);
+		}
+		return 0;
+	}
+
+	for (y = 0; y < height; y++) {
+		unsigned char *sp = src ? src + y * src_stride : NULL;
+		unsigned char *dp = dst + y * dst_stride;
+
+		for (x = 0; x < width; x++) {
+			unsigned int raw = sw_read_raw(dp, df.pixelbyte);
+			int s[4], d[4], o[4];
+
+			if (sp) {
+				sw_unpack(&sf, sw_read_raw(sp, sf.pixelbyte), s);
+				if (force_alpha)
+					s[0] = sc[0];
+				sp += sf.pixelbyte;
+			} else if (solid_enb) {
+				memcpy(s, sc, sizeof(s));
+			} else {
+				memset(s, 0, sizeof(s));
+				if (force_alpha)
+					s[0] = sc[0];
+			}
+
+			if (dst_rd)
+				sw_unpack(&df, raw, d);
+			else
+				memset(d, 0, sizeof(d));
+
+			for (i = 0; i < 4; i++) {
+				if (rop_enb)
+					o[i] = sw_rop(rop, s[i], d[i]);
+				else if (blend_enb)
+					o[i] = sw_equation(i ? eq_rgb : eq_a,
+						s[i], d[i],
+						sw_factor(i ? fs_rgb : fs_a,
+							  i, s, d, k),
+						sw_factor(i ? fd_rgb : fd_a,
+							  i, s, d, k));
+				else
+					o[i] = s[i];
+			}
+
+			/* WRITE_MASK bits are R, G, B, A from MSB */
+			if (wmask != 0xf) {
+				int cur[4];
+
+				sw_unpack(&df, raw, cur);
+				for (i = 0; i < 4; i++) {
+					if (!(wmask & BIT(i ? 4 - i : 0)))
+						o[i] = cur[i];
+				}
+			}
+
+			sw_write_raw(dp, df.pixelbyte,
+				sw_pack(&df, o, dither ?
+					sw_dither[(y + dither_y) & 3]
+						 [(x + dither_x) & 3] : -1));
+			dp += df.pixelbyte;
+		}
+	}
+
+	return 0;
+}
+
+/* ARGB8888 color in the pixel layout of a color format */
+unsigned int nx_g2d_sw_color(int pixelformat, int pixelorder,
+			     unsigned int argb)
+{
+	int c[4] = { (argb >> 24) & 0xff, (argb >> 16) & 0xff,
+		     (argb >> 8) & 0xff, argb & 0xff };
+	struct sw_format f;
+
+	sw_format_decode(&f, BITS(pixelorder, 2, 4) | BITS(pixelformat, 4, 0));
+
+	return f.valid ? sw_pack(&f, c, -1) : 0;
+}
+
+/* end offset of the source or destination area of a command, 0 if unused */
+unsigned long nx_g2d_sw_area_end(const struct nx_g2d_cmd *cmd, bool src)
+{
+	unsigned int src_ctrl = cmd->cmd[NX_G2D_CMD_SRC_CTRL];
+	unsigned int ctrl = cmd->cmd[src ? NX_G2D_CMD_SRC_CTRL :
+					   NX_G2D_CMD_DST_CTRL];
+	unsigned int size = cmd->cmd[NX_G2D_CMD_SIZE];
+	int stride = cmd->cmd[src ? NX_G2D_CMD_SRC_STRIDE :
+				    NX_G2D_CMD_DST_STRIDE];
+	int width = FIELD(size, 12, 0) + 1;
+	int height = FIELD(size, 12, 16) + 1;
+	struct sw_format f;
+
+	if (FIELD(src_ctrl, 1, 18))	/* DISCARD */
+		return 0;
+
+	if (src && (!FIELD(src_ctrl, 1, 6) || FIELD(src_ctrl, 1, 17)))
+		return 0;
+
+	sw_format_decode(&f, ctrl);
+	if (!f.valid)
+		return 0;
+
+	return (src ? cmd->src.offset : cmd->dst.offset) +
+		(unsigned long)stride * (height - 1) + width * f.pixelbyte;
+}
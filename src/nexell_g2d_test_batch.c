@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Command batch test: drmIoctl is replaced by a stub counting the G2D
+ * ioctls, and a frame of small fills is run without batching, with a
+ * batch, and with a batch on a kernel rejecting the list ioctl.
+ *
+ * Batching only saves ioctls when the kernel header provides
+ * DRM_IOCTL_NX_G2D_DMA_EXEC_LIST, otherwise a batch is replayed as one
+ * DRM_IOCTL_NX_G2D_DMA_EXEC per command and the counts must match.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <xf86drm.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+#define TEST_FILLS	200	/* fills per frame */
+#define TEST_BATCH	64
+
+static struct {
+	int exec;
+	int list;
+	int sync;
+	bool list_enotty;	/* kernel without the list ioctl */
+} calls;
+
+int drmIoctl(int fd __attribute__((unused)), unsigned long request,
+	     void *arg)
+{
+	if (request == DRM_IOCTL_NX_G2D_GET_VER) {
+		struct nx_g2d_ver *ver = arg;
+
+		ver->major = NX_G2D_DRIVER_VER_MAJOR;
+		ver->minor = NX_G2D_DRIVER_VER_MINOR;
+		return 0;
+	}
+
+	if (request == DRM_IOCTL_NX_G2D_DMA_EXEC) {
+		calls.exec++;
+		return 0;
+	}
+
+	if (request == DRM_IOCTL_NX_G2D_DMA_SYNC) {
+		calls.sync++;
+		return 0;
+	}
+
+#ifdef DRM_IOCTL_NX_G2D_DMA_EXEC_LIST
+	if (request == DRM_IOCTL_NX_G2D_DMA_EXEC_LIST) {
+		calls.list++;
+		if (calls.list_enotty) {
+			errno = ENOTTY;
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
+	errno = EINVAL;
+	return -1;
+}
+
+/* one frame of fills followed by a sync, returns the ioctls done */
+static int
+test_frame(int batch, bool list_enotty)
+{
+	struct nx_g2d_ctx *ctx;
+	struct nx_g2d_image img;
+	int i, ioctls;
+
+	memset(&calls, 0, sizeof(calls));
+	calls.list_enotty = list_enotty;
+
+	ctx = nexell_g2d_alloc_flags(-1, 0, NULL, NULL);
+	if (!ctx) {
+		fprintf(stderr, "no context\n");
+		exit(1);
+	}
+
+	/* G2D only, no CPU mapping */
+	nexell_g2d_set_cpu_threshold(ctx, 0);
+
+	if (batch && nexell_g2d_batch_begin(ctx, batch, 0)) {
+		fprintf(stderr, "no batch\n");
+		exit(1);
+	}
+
+	memset(&img, 0, sizeof(img));
+	img.dst.type = NX_G2D_BUF_TYPE_GEM;
+	img.dst.handle = 1;
+	img.dst.pitch = 64 * 4;
+	img.dst.pixelformat = NX_G2D_PIXEL_FMT_ARGB8888;
+	img.dst.pixelorder = NX_G2D_PIXEL_ORDER_ARGB;
+	img.dst.pixelbyte = 4;
+	img.width = 8;
+	img.height = 8;
+	img.fillcolor = 0xff00ff00;
+
+	for (i = 0; i < TEST_FILLS; i++) {
+		img.dst.offset = (i % 8) * 8 * img.dst.pitch;
+		if (nexell_g2d_fillrect(ctx, &img) < 0) {
+			fprintf(stderr, "fill %d failed\n", i);
+			exit(1);
+		}
+	}
+
+	if (nexell_g2d_sync(ctx) < 0) {
+		fprintf(stderr, "sync failed\n");
+		exit(1);
+	}
+
+	nexell_g2d_free(ctx);
+
+	ioctls = calls.exec + calls.list + calls.sync;
+
+	printf("batch %2d%s: exec %d list %d sync %d, %d ioctls\n",
+	       batch, list_enotty ? " (no list)" : "",
+	       calls.exec, calls.list, calls.sync, ioctls);
+
+	return ioctls;
+}
+
+/* batch probe, 1 if the list ioctl is accepted */
+static int
+test_probe(bool list_enotty)
+{
+	struct nx_g2d_ctx *ctx;
+	int ret;
+
+	memset(&calls, 0, sizeof(calls));
+	calls.list_enotty = list_enotty;
+
+	ctx = nexell_g2d_alloc_flags(-1, 0, NULL, NULL);
+	if (!ctx) {
+		fprintf(stderr, "no context\n");
+		exit(1);
+	}
+
+	ret = nexell_g2d_batch_probe(ctx);
+	nexell_g2d_free(ctx);
+
+	printf("probe%s: %d\n", list_enotty ? " (no list)" : "", ret);
+
+	return ret;
+}
+
+int main(void)
+{
+	int single, batched, fallback, expect;
+
+	single = test_frame(0, false);
+	if (calls.exec != TEST_FILLS || calls.list || calls.sync != 1)
+		return 1;
+
+	batched = test_frame(TEST_BATCH, false);
+#ifdef DRM_IOCTL_NX_G2D_DMA_EXEC_LIST
+	/* full batches and the rest flushed on sync as lists */
+	expect = (TEST_FILLS + TEST_BATCH - 1) / TEST_BATCH;
+	if (calls.list != expect || calls.exec || batched >= single)
+		return 1;
+#else
+	/* without the list ioctl a batch saves no ioctl */
+	expect = TEST_FILLS;
+	if (calls.exec != expect || batched != single)
+		return 1;
+#endif
+
+	/* rejected list: tried once, then every command on its own */
+	fallback = test_frame(TEST_BATCH, true);
+	if (calls.exec != TEST_FILLS || calls.list > 1 ||
+	    fallback > single + 1)
+		return 1;
+
+	/* batching is only worth it with the list ioctl */
+	if (test_probe(true))
+		return 1;
+#ifdef DRM_IOCTL_NX_G2D_DMA_EXEC_LIST
+	if (test_probe(false) != 1)
+		return 1;
+#else
+	if (test_probe(false))
+		return 1;
+#endif
+
+	return 0;
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2019 Nexell Co.Ltd
+ * Authors:
+ *      JungHyun Kim <jhkim@nexell.co.kr>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * VA LINUX SYSTEMS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "nexell_g2d.h"
+#include "nexell_g2d_priv.h"
+
+/*
+ * Operation trace
+ *
+ * Each thread writes its records to a ring of its own, so recording
+ * takes no lock and no atomic read-modify-write: the record is stored
+ * and the head published with a release store. The rings are linked on
+ * a list when created and are never freed, the dumper walks them while
+ * the threads may still record. Nothing is formatted before the dump.
+ */
+
+#define TRACE_SIZE	4096	/* records per thread */
+#define TRACE_CONTEXTS	16	/* contexts told apart by the export */
+
+/* trace_marker of tracefs, or a file when not available */
+static const char * const marker_paths[] = {
+	"/sys/kernel/tracing/trace_marker",
+	"/sys/kernel/debug/tracing/trace_marker",
+};
+
+#define MARKER_FILE	"/tmp/nexell_g2d.marker"
+
+struct trace_ring {
+	struct trace_ring *next;
+	long tid;
+	__u64 head;			/* records written */
+	struct nx_g2d_trace_rec recs[];
+};
+
+/* a record of the export, with the flows it starts or ends */
+struct trace_event {
+	struct nx_g2d_trace_rec rec;
+	long tid;
+	__u64 submit;			/* op: serial of its submission */
+	__u64 sync;			/* submission: serial of its sync */
+};
+
+unsigned int nx_g2d_trace_size;
+int nx_g2d_marker_fd = -1;
+
+static __thread struct trace_ring *trace_local;
+static struct trace_ring *trace_rings;
+static const char *trace_file;
+static const char *trace_json;
+static bool marker_file;
+
+static const char * const trace_names[] = {
+	[NX_G2D_TRACE_FILL] = "fill",
+	[NX_G2D_TRACE_BLIT] = "blit",
+	[NX_G2D_TRACE_SUBMIT] = "submit",
+	[NX_G2D_TRACE_EXEC] = "exec",
+	[NX_G2D_TRACE_SYNC] = "sync",
+};
+
+static struct trace_ring *
+trace_ring_create(void)
+{
+	struct trace_ring *ring;
+
+	ring = calloc(1, sizeof(*ring) +
+		      nx_g2d_trace_size * sizeof(struct nx_g2d_trace_rec));
+	if (!ring)
+		return NULL;
+
+	ring->tid = syscall(SYS_gettid);
+
+	ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring,
+					    true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	return ring;
+}
+
+void nx_g2d_trace_add(const struct nx_g2d_trace_rec *rec)
+{
+	struct trace_ring *ring = trace_local;
+	struct nx_g2d_trace_rec *r;
+	__u64 dur = nx_g2d_time_ns() - rec->ts;
+
+	if (!ring) {
+		ring = trace_ring_create();
+		if (!ring)
+			return;
+		trace_local = ring;
+	}
+
+	r = &ring->recs[ring->head & (nx_g2d_trace_size - 1)];
+	*r = *rec;
+	r->dur = dur > 0xffffffff ? 0xffffffff : dur;
+
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* calls fn for the records of the ring still valid */
+static void
+trace_ring_walk(struct trace_ring *ring,
+		void (*fn)(const struct nx_g2d_trace_rec *rec, long tid,
+			   void *data), void *data)
+{
+	__u64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	__u64 i = head > nx_g2d_trace_size ? head - nx_g2d_trace_size : 0;
+
+	for (; i < head; i++) {
+		struct nx_g2d_trace_rec rec =
+			ring->recs[i & (nx_g2d_trace_size - 1)];
+
+		/* overwritten while being read */
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >
+		    i + nx_g2d_trace_size)
+			continue;
+
+		fn(&rec, ring->tid, data);
+	}
+}
+
+static void
+trace_walk(void (*fn)(const struct nx_g2d_trace_rec *rec, long tid,
+		      void *data), void *data)
+{
+	struct trace_ring *ring;
+
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring;
+	     ring = ring->next)
+		trace_ring_walk(ring, fn, data);
+}
+
+static void
+trace_print(const struct nx_g2d_trace_rec *rec, long tid, void *data)
+{
+	FILE *fp = data;
+
+	fprintf(fp, "%ld %llu.%06llu %s ctx %u serial %llu %u us",
+		tid, (unsigned long long)(rec->ts / 1000000000),
+		(unsigned long long)(rec->ts / 1000 % 1000000),
+		trace_names[rec->type], rec->ctx,
+		(unsigned long long)rec->serial, rec->dur / 1000);
+
+	switch (rec->type) {
+	case NX_G2D_TRACE_BLIT:
+		fprintf(fp, " src 0x%x", rec->src);
+		/* fall through */
+	case NX_G2D_TRACE_FILL:
+		fprintf(fp, " dst 0x%x %d,%d %dx%d\n", rec->dst,
+			rec->x, rec->y, rec->w, rec->h);
+		break;
+	case NX_G2D_TRACE_SUBMIT:
+	case NX_G2D_TRACE_EXEC:
+		fprintf(fp, " commands %d\n", rec->x);
+		break;
+	default:
+		fprintf(fp, "\n");
+		break;
+	}
+}
+
+drm_public
+int nexell_g2d_trace_dump(const char *path)
+{
+	FILE *fp;
+
+	if (!nx_g2d_trace_size)
+		return -ENODEV;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	trace_walk(trace_print, fp);
+
+	fclose(fp);
+
+	return 0;
+}
+
+struct trace_events {
+	struct trace_event *events;
+	int count, size;
+};
+
+static void
+trace_collect(const struct nx_g2d_trace_rec *rec, long tid, void *data)
+{
+	struct trace_events *ev = data;
+
+	/* records added since the events were counted */
+	if (ev->count == ev->size)
+		return;
+
+	ev->events[ev->count].rec = *rec;
+	ev->events[ev->count].tid = tid;
+	ev->events[ev->count].submit = 0;
+	ev->events[ev->count].sync = 0;
+	ev->count++;
+}
+
+static int
+trace_event_cmp(const void *a, const void *b)
+{
+	const struct trace_event *ea = a, *eb = b;
+
+	return ea->rec.ts < eb->rec.ts ? -1 : ea->rec.ts > eb->rec.ts;
+}
+
+/*
+ * Links each operation to the submission of its commands and each
+ * submission to the sync retiring it: the next ones of the context in
+ * time with a serial not below its own.
+ */
+static void
+trace_link(struct trace_event *events, int count)
+{
+	__u64 submit[TRACE_CONTEXTS] = { 0 };
+	__u64 sync[TRACE_CONTEXTS] = { 0 };
+	int i;
+
+	for (i = count - 1; i >= 0; i--) {
+		struct trace_event *ev = &events[i];
+		int c = ev->rec.ctx % TRACE_CONTEXTS;
+
+		switch (ev->rec.type) {
+		case NX_G2D_TRACE_FILL:
+		case NX_G2D_TRACE_BLIT:
+			if (ev->rec.serial && submit[c] >= ev->rec.serial)
+				ev->submit = submit[c];
+			break;
+		case NX_G2D_TRACE_SUBMIT:
+			submit[c] = ev->rec.serial;
+			if (sync[c] >= ev->rec.serial)
+				ev->sync = sync[c];
+			break;
+		case NX_G2D_TRACE_SYNC:
+			sync[c] = ev->rec.serial;
+			break;
+		}
+	}
+}
+
+/* flow step of a Chrome trace, bound to the slice at its timestamp */
+static void
+trace_flow(FILE *fp, const struct trace_event *ev, const char *name,
+	   char ph, char kind, __u64 serial)
+{
+	fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"g2d\",\"ph\":\"%c\","
+		"\"id\":\"%c%u.%llu\",\"pid\":%d,\"tid\":%ld,"
+		"\"ts\":%llu.%03llu%s}",
+		name, ph, kind, ev->rec.ctx, (unsigned long long)serial,
+		getpid(), ev->tid,
+		(unsigned long long)(ev->rec.ts / 1000),
+		(unsigned long long)(ev->rec.ts % 1000),
+		ph == 'f' ? ",\"bp\":\"e\"" : "");
+}
+
+static void
+trace_slice(FILE *fp, const struct trace_event *ev)
+{
+	const struct nx_g2d_trace_rec *rec = &ev->rec;
+
+	fprintf(fp, "{\"name\":\"%s\",\"cat\":\"g2d\",\"ph\":\"X\","
+		"\"pid\":%d,\"tid\":%ld,\"ts\":%llu.%03llu,\"dur\":%u.%03u,"
+		"\"args\":{\"ctx\":%u,\"serial\":%llu",
+		trace_names[rec->type], getpid(), ev->tid,
+		(unsigned long long)(rec->ts / 1000),
+		(unsigned long long)(rec->ts % 1000),
+		rec->dur / 1000, rec->dur % 1000,
+		rec->ctx, (unsigned long long)rec->serial);
+
+	switch (rec->type) {
+	case NX_G2D_TRACE_BLIT:
+		fprintf(fp, ",\"src\":%u", rec->src);
+		/* fall through */
+	case NX_G2D_TRACE_FILL:
+		fprintf(fp, ",\"dst\":%u,\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d",
+			rec->dst, rec->x, rec->y, rec->w, rec->h);
+		break;
+	case NX_G2D_TRACE_SUBMIT:
+	case NX_G2D_TRACE_EXEC:
+		fprintf(fp, ",\"commands\":%d", rec->x);
+		break;
+	}
+
+	fprintf(fp, "}}");
+}
+
+static void
+trace_events_write(FILE *fp, const struct trace_event *events, int count)
+{
+	__u64 submit[TRACE_CONTEXTS] = { 0 };
+	__u64 sync[TRACE_CONTEXTS] = { 0 };
+	int i;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		"\"args\":{\"name\":\"nexell g2d\"}}", getpid());
+
+	for (i = 0; i < count; i++) {
+		const struct trace_event *ev = &events[i];
+		int c = ev->rec.ctx % TRACE_CONTEXTS;
+
+		fprintf(fp, ",\n");
+		trace_slice(fp, ev);
+
+		/* operations of a submission chained, the last one ends */
+		if (ev->submit) {
+			trace_flow(fp, ev, "submit",
+				   submit[c] == ev->submit ? 't' : 's',
+				   's', ev->submit);
+			submit[c] = ev->submit;
+		}
+
+		if (ev->rec.type == NX_G2D_TRACE_SUBMIT) {
+			if (submit[c] == ev->rec.serial) {
+				trace_flow(fp, ev, "submit", 'f', 's',
+					   ev->rec.serial);
+				submit[c] = 0;
+			}
+			if (ev->sync) {
+				trace_flow(fp, ev, "complete",
+					   sync[c] == ev->sync ? 't' : 's',
+					   'c', ev->sync);
+				sync[c] = ev->sync;
+			}
+		}
+
+		if (ev->rec.type == NX_G2D_TRACE_SYNC &&
+		    sync[c] == ev->rec.serial) {
+			trace_flow(fp, ev, "complete", 'f', 'c', ev->rec.serial);
+			sync[c] = 0;
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+}
+
+static void
+trace_count(const struct nx_g2d_trace_rec *rec __attribute__((unused)),
+	    long tid __attribute__((unused)), void *data)
+{
+	(*(int *)data)++;
+}
+
+drm_public
+int nexell_g2d_trace_export(const char *path)
+{
+	struct trace_events ev = { 0 };
+	FILE *fp;
+	int size = 0;
+
+	if (!nx_g2d_trace_size)
+		return -ENODEV;
+
+	trace_walk(trace_count, &size);
+
+	ev.events = malloc((size + 1) * sizeof(*ev.events));
+	if (!ev.events)
+		return -ENOMEM;
+	ev.size = size;
+
+	trace_walk(trace_collect, &ev);
+	qsort(ev.events, ev.count, sizeof(*ev.events), trace_event_cmp);
+	trace_link(ev.events, ev.count);
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		free(ev.events);
+		return -errno;
+	}
+
+	trace_events_write(fp, ev.events, ev.count);
+
+	fclose(fp);
+	free(ev.events);
+
+	return 0;
+}
+
+static void
+marker_write(const char *buf, int len)
+{
+	if (len > 0 && write(nx_g2d_marker_fd, buf, len) < 0)
+		D_DEBUG("trace marker write failed\n");
+}
+
+/* the file sink gets the thread and time the kernel would add */
+static int
+marker_prefix(char *buf, int size)
+{
+	__u64 ts;
+
+	if (!marker_file)
+		return 0;
+
+	ts = nx_g2d_time_ns();
+
+	return snprintf(buf, size, "%ld %llu.%06llu: ",
+			(long)syscall(SYS_gettid),
+			(unsigned long long)(ts / 1000000000),
+			(unsigned long long)(ts / 1000 % 1000000));
+}
+
+void nx_g2d_marker_begin(const char *fmt, ...)
+{
+	char buf[256];
+	va_list arg;
+	int n;
+
+	n = marker_prefix(buf, sizeof(buf));
+	n += snprintf(buf + n, sizeof(buf) - n, "B|%d|", getpid());
+
+	va_start(arg, fmt);
+	n += vsnprintf(buf + n, sizeof(buf) - n, fmt, arg);
+	va_end(arg);
+
+	if (n > (int)sizeof(buf) - 2)
+		n = sizeof(buf) - 2;
+	buf[n++] = '\n';
+
+	marker_write(buf, n);
+}
+
+void nx_g2d_marker_end(void)
+{
+	char buf[64];
+	int n;
+
+	n = marker_prefix(buf, sizeof(buf));
+	n += snprintf(buf + n, sizeof(buf) - n, "E|%d\n", getpid());
+
+	marker_write(buf, n);
+}
+
+static void
+marker_init(const char *env)
+{
+	unsigned int i;
+
+	if (strcmp(env, "1")) {
+		marker_file = true;
+	} else {
+		for (i = 0; i < sizeof(marker_paths) / sizeof(marker_paths[0]);
+		     i++) {
+			nx_g2d_marker_fd = open(marker_paths[i],
+						O_WRONLY | O_CLOEXEC);
+			if (nx_g2d_marker_fd >= 0) {
+				D_DEBUG("trace marker %s\n", marker_paths[i]);
+				return;
+			}
+		}
+
+		marker_file = true;
+		env = MARKER_FILE;
+	}
+
+	nx_g2d_marker_fd = open(env, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+				0644);
+	if (nx_g2d_marker_fd < 0)
+		D_ERROR("%s() cannot open trace marker %s\n", __func__, env);
+	else
+		D_DEBUG("trace marker file %s\n", env);
+}
+
+static void
+trace_exit(void)
+{
+	if (trace_file && nexell_g2d_trace_dump(trace_file) < 0)
+		D_ERROR("%s() cannot write trace %s\n", __func__, trace_file);
+
+	if (trace_json && nexell_g2d_trace_export(trace_json) < 0)
+		D_ERROR("%s() cannot write trace %s\n", __func__, trace_json);
+}
+
+/* resolved once when the library is loaded */
+__attribute__((constructor))
+static void trace_init(void)
+{
+	const char *env;
+	unsigned int size;
+	int n;
+
+	env = getenv("NEXELL_G2D_TRACE_MARKER");
+	if (env && *env && strcmp(env, "0"))
+		marker_init(env);
+
+	env = getenv("NEXELL_G2D_TRACE");
+	if (!env || !*env)
+		return;
+
+	n = atoi(env);
+	if (n <= 0)
+		return;
+
+	/* power of two for the index mask */
+	for (size = 2; size < (unsigned int)n && size < (1U << 24); size <<= 1)
+		;
+	nx_g2d_trace_size = n == 1 ? TRACE_SIZE : size;
+
+	trace_file = getenv("NEXELL_G2D_TRACE_FILE");
+	if (trace_file && !*trace_file)
+		trace_file = NULL;
+
+	trace_json = getenv("NEXELL_G2D_TRACE_JSON");
+	if (trace_json && !*trace_json)
+		trace_json = NULL;
+
+	if (trace_file || trace_json)
+		atexit(trace_exit);
+
+	D_DEBUG("trace %u records per thread\n", nx_g2d_trace_size);
+}